@@ -0,0 +1,83 @@
+#ifndef _QT_TOX_BOOTSTRAP_MANAGER_H_
+#define _QT_TOX_BOOTSTRAP_MANAGER_H_
+
+#include "connection.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+#include <cstdint>
+
+namespace QtTox
+{
+
+class Core;
+
+class BootstrapManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Node
+    {
+        QString address;
+        uint16_t port;
+        QByteArray publicKey;
+        // 0 if the node isn't a TCP relay
+        uint16_t tcpPort;
+    };
+
+    struct NodeStats
+    {
+        Node node;
+        // smoothed time from bootstrapping the node to coming online, -1 if unknown
+        qint64 latencyMs;
+        uint32_t successes;
+        uint32_t failures;
+    };
+
+    BootstrapManager(Core* core, const QString& cachePath, int parallel = 4,
+            int waveTimeoutMs = 3000);
+
+    void setNodes(const QVector<Node>& nodes);
+    void start();
+    bool isOnline() const;
+    QVector<NodeStats> getRanking() const;
+    bool saveCache() const;
+
+    Q_SIGNAL void online(qint64 elapsedMs);
+
+private:
+    void loadCache();
+    void nextWave();
+    void onConnectionChanged(Connection status);
+    void credit(const QVector<int>& indices, qint64 latency);
+    void blame(QVector<int>& indices);
+    void rank();
+    int findNode(const Node& node) const;
+
+private:
+    Core* core;
+    QString cachePath;
+    int parallel;
+    int waveTimeout;
+    QVector<NodeStats> nodes;
+    // indices into nodes of the current wave
+    QVector<int> wave;
+    // the wave before, until its grace period passed
+    QVector<int> previousWave;
+    int nextNode = 0;
+    QTimer timer;
+    QElapsedTimer sinceStart;
+    QElapsedTimer sinceWave;
+    QElapsedTimer sincePreviousWave;
+    bool connected = false;
+};
+
+}
+
+#endif // _QT_TOX_BOOTSTRAP_MANAGER_H_
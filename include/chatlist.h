@@ -76,6 +76,9 @@ public:
     // Get list of conference numbers
     QVector<uint32_t> getChatlist() const;
 
+    // Emitted after a change that is part of the savedata
+    Q_SIGNAL void savedataChanged();
+
 private:
     struct Tox* tox;
 };
@@ -0,0 +1,55 @@
+#ifndef _QT_TOX_CHUNK_BUFFER_H_
+#define _QT_TOX_CHUNK_BUFFER_H_
+
+#include <QByteArray>
+#include <QMetaType>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace QtTox
+{
+
+struct ChunkSlab;
+
+class ChunkBuffer
+{
+public:
+    // Large enough for any file chunk toxcore requests or delivers
+    static constexpr size_t SlabSize = 2048;
+
+    struct PoolStats
+    {
+        uint64_t allocations;
+        uint64_t reuses;
+    };
+
+    ChunkBuffer();
+    ChunkBuffer(const ChunkBuffer& other);
+    ChunkBuffer(ChunkBuffer&& other);
+    ChunkBuffer& operator=(const ChunkBuffer& other);
+    ChunkBuffer& operator=(ChunkBuffer&& other);
+    ~ChunkBuffer();
+
+    static ChunkBuffer allocate(size_t length);
+    static ChunkBuffer copy(const uint8_t* data, size_t length);
+    static PoolStats getPoolStats();
+
+    bool isNull() const;
+    const uint8_t* data() const;
+    uint8_t* data();
+    size_t size() const;
+    QByteArray toByteArray() const;
+
+private:
+    explicit ChunkBuffer(ChunkSlab* slab);
+
+private:
+    ChunkSlab* slab;
+};
+
+}
+
+Q_DECLARE_METATYPE(QtTox::ChunkBuffer)
+
+#endif // _QT_TOX_CHUNK_BUFFER_H_
@@ -1,23 +1,28 @@
 #ifndef _QT_TOX_COMMON_H_
 #define _QT_TOX_COMMON_H_
 
+#include <cstdint>
+
 namespace QtTox
 {
 
-static constexpr uint32_t PublicKeySize;
-static constexpr uint32_t SecretKeySize;
-static constexpr uint32_t NospamSize;
-static constexpr uint32_t AddressSize;
+static constexpr uint32_t PublicKeySize = 32;
+static constexpr uint32_t SecretKeySize = 32;
+static constexpr uint32_t NospamSize = 4;
+static constexpr uint32_t AddressSize = 38;
+
+static constexpr uint32_t MaxNameLength = 128;
+static constexpr uint32_t MaxStatusMessageLength = 1007;
+static constexpr uint32_t MaxFriendRequestLength = 1016;
+static constexpr uint32_t MaxMessageLength = 1372;
+static constexpr uint32_t MaxCustomPacketSize = 1373;
+static constexpr uint32_t MaxFilenameLength = 255;
 
-static constexpr uint32_t MaxNameLength;
-static constexpr uint32_t MaxStatusMessageLength;
-static constexpr uint32_t MaxFriendRequestLength;
-static constexpr uint32_t MaxMessageLength;
-static constexpr uint32_t MaxCustomPacketSize;
-static constexpr uint32_t MaxFilenameLength;
+// toxcore sets no avatar size limit, this is the cap the client applies
+static constexpr uint32_t DefaultMaxAvatarSize = 64 * 1024;
 
-static constexpr uint32_t HashLength;
-static constexpr uint32_t FileIdLength;
+static constexpr uint32_t HashLength = 32;
+static constexpr uint32_t FileIdLength = 32;
 
 }
 
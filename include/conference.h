@@ -6,17 +6,23 @@
 
 #include <QObject>
 
+#include <memory>
+
+class ToxString;
 struct Tox;
 
 namespace QtTox
 {
 
+class MessageDedup;
+
 class Conference : public QObject
 {
     Q_OBJECT
 public:
 
     Conference(struct Tox* tox);
+    ~Conference();
 
     Q_SIGNAL void messageReceived(uint32_t conferenceNum, uint32_t peerNum,
             MessageType type, const QString& message);
@@ -67,11 +73,17 @@ public:
         TooLong,
         NoConnection,
         FailSend,
+        Duplicate,
     };
 
     bool sendMessage(uint32_t conferenceNum, MessageType type, const QString& message,
             ErrSendMessage* err = nullptr);
+    bool sendMessage(uint32_t conferenceNum, MessageType type, const ToxString& message,
+            ErrSendMessage* err = nullptr);
 
+    // Suppress repeated messages seen within the window, 0 disables
+    void setDedupWindow(uint32_t windowMs, int capacity = 65536);
+    uint64_t getSuppressedCount() const;
 
     enum class ErrTitle
     {
@@ -92,8 +104,12 @@ public:
 
     ConferenceType getType(uint32_t conferenceNum, ErrGetType* err = nullptr);
 
+    bool isDuplicateMessage(uint32_t conferenceNum, uint32_t peerNum,
+            const uint8_t* message, size_t length);
+
 private:
     struct Tox* tox;
+    std::unique_ptr<MessageDedup> dedup;
 };
 
 }
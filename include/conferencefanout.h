@@ -0,0 +1,69 @@
+#ifndef _QT_TOX_CONFERENCE_FANOUT_H_
+#define _QT_TOX_CONFERENCE_FANOUT_H_
+
+#include "conference.h"
+#include "messagetype.h"
+#include "toxstring.h"
+
+#include <QHash>
+#include <QObject>
+#include <QQueue>
+#include <QVector>
+
+namespace QtTox
+{
+
+class ConferenceFanout : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ConferenceFanout(Conference* conference, int maxAttempts = 8);
+
+    uint64_t post(const QVector<uint32_t>& conferenceNums, MessageType type,
+            const QString& message);
+    void iterate();
+
+    int getPendingCount() const;
+
+    Q_SIGNAL void sendResult(uint64_t postId, uint32_t conferenceNum,
+            Conference::ErrSendMessage result);
+    Q_SIGNAL void postFinished(uint64_t postId, int sent, int failed);
+
+private:
+    struct Pending
+    {
+        uint64_t postId;
+        MessageType type;
+        ToxString message;
+        int attempts;
+    };
+
+    struct Result
+    {
+        uint64_t postId;
+        uint32_t conferenceNum;
+        Conference::ErrSendMessage err;
+    };
+
+    struct Progress
+    {
+        int remaining;
+        int sent;
+        int failed;
+    };
+
+    bool trySend(uint32_t conferenceNum, Pending& pending, QVector<Result>& results);
+    void report(const QVector<Result>& results);
+
+private:
+    Conference* conference;
+    int maxAttempts;
+    uint64_t nextPostId = 1;
+    QHash<uint32_t, QQueue<Pending>> queues;
+    QHash<uint64_t, Progress> progress;
+};
+
+}
+
+#endif // _QT_TOX_CONFERENCE_FANOUT_H_
@@ -0,0 +1,71 @@
+#ifndef _QT_TOX_CONTACT_CACHE_H_
+#define _QT_TOX_CONTACT_CACHE_H_
+
+#include "connection.h"
+#include "userstatus.h"
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+#include <cstdint>
+
+struct Tox;
+
+namespace QtTox
+{
+
+class Messenger;
+class StartupReport;
+
+class ContactCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Friend
+    {
+        uint32_t friendNum;
+        QByteArray publicKey;
+        QString name;
+        QString statusMessage;
+        UserStatus status;
+        Connection connection;
+        uint64_t lastOnline;
+    };
+
+    struct Conference
+    {
+        uint32_t conferenceNum;
+        QString title;
+    };
+
+    explicit ContactCache(struct Tox* tox);
+
+    void build(StartupReport* report = nullptr);
+    void attach(Messenger* messenger);
+
+    void refreshFriend(uint32_t friendNum);
+    void removeFriend(uint32_t friendNum);
+
+    const Friend* getFriend(uint32_t friendNum) const;
+    QVector<Friend> getFriends() const;
+    QVector<Conference> getConferences() const;
+
+private:
+    bool fill(Friend& info);
+    uint8_t* reserve(size_t size);
+
+private:
+    struct Tox* tox;
+    // indexed by friend number, which toxcore keeps dense
+    QVector<Friend> friends;
+    QVector<bool> present;
+    QVector<Conference> conferences;
+    QByteArray buffer;
+};
+
+}
+
+#endif // _QT_TOX_CONTACT_CACHE_H_
@@ -1,7 +1,14 @@
 #ifndef _QT_TOX_CORE_H_
 #define _QT_TOX_CORE_H_
 
+#include "options.h"
+
+#include <QByteArray>
 #include <QObject>
+#include <QString>
+
+#include <cstdint>
+#include <memory>
 
 struct Tox;
 
@@ -13,8 +20,9 @@ class Conference;
 class Files;
 class LowLevel;
 class Messenger;
-class Options;
 class Self;
+class StartupReport;
+struct Services;
 
 class Core : public QObject
 {
@@ -34,9 +42,10 @@ public:
         ProxyNotFound,
         LoadEncrypted,
         LoadBadFormat,
-    }
+    };
 
-    Core(const Options& options, ErrNew* error = nullptr);
+    // Pass a report to add the phases of Core to earlier ones, e.g. from ProfileLoader
+    Core(const Options& options, ErrNew* error = nullptr, StartupReport* report = nullptr);
     ~Core();
 
     QByteArray getSavedata();
@@ -51,27 +60,44 @@ public:
     bool bootstrap(const QString& address, uint16_t port, 
             const QByteArray& publicKey, ErrBootstrap* err = nullptr);
     bool addTcpReleay(const QString& address, uint16_t port, 
-            ErrBootstrap* err = nullptr);
+            const QByteArray& publicKey, ErrBootstrap* err = nullptr);
 
     uint32_t iterationInterval() const;
     void iterate();
-    
+
+    const StartupReport& getStartupReport() const;
+    Q_SIGNAL void startupFinished();
+
+    ChatList* getChatList() const;
+    Conference* getConference() const;
+    Files* getFiles() const;
+    LowLevel* getLowLevel() const;
+    Messenger* getMessenger() const;
+    Self* getSelf() const;
+
 signals:
-    void Log(LogLevel level, const QString& file, uint32_t line,
+    void Log(Options::ToxLogLevel level, const QString& file, uint32_t line,
             const QString& func, const QString& message);
 
+private:
+    void finishStartup();
 
 private:
-    struct Tox* tox;
-    ChatList* chatList;
-    Conference* conference;
-    Files* files;
-    LowLevel* lowLevel;
-    Messenger* messenger;
-    Options* options;
-    Self* self;
+    struct Tox* tox = nullptr;
+    ChatList* chatList = nullptr;
+    Conference* conference = nullptr;
+    Files* files = nullptr;
+    LowLevel* lowLevel = nullptr;
+    Messenger* messenger = nullptr;
+    Self* self = nullptr;
+    std::unique_ptr<Services> services;
+    std::unique_ptr<StartupReport> ownReport;
+    StartupReport* report;
+    qint64 constructedAt = 0;
+    qint64 bootstrapStart = -1;
+    bool online = false;
 };
 
 }
 
-#endif // _Q_TOX_CORE_H_
+#endif // _QT_TOX_CORE_H_
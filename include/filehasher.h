@@ -0,0 +1,32 @@
+#ifndef _QT_TOX_FILE_HASHER_H_
+#define _QT_TOX_FILE_HASHER_H_
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+
+namespace QtTox
+{
+
+class FileHasher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit FileHasher(int maxThreads = QThread::idealThreadCount());
+    ~FileHasher();
+
+    void hashFile(const QString& path);
+    void waitForDone();
+
+    // Emitted from a worker thread, fileId is empty if the file can't be read
+    Q_SIGNAL void fileHashed(const QString& path, const QByteArray& fileId);
+
+private:
+    QThreadPool pool;
+};
+
+}
+
+#endif // _QT_TOX_FILE_HASHER_H_
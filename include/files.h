@@ -1,14 +1,31 @@
 #ifndef _Q_TOX_FILES_H_
 #define _Q_TOX_FILES_H_
 
+#include "chunkbuffer.h"
+#include "common.h"
+
+#include <QHash>
 #include <QObject>
+#include <QVector>
+
+#include <memory>
 
 struct Tox;
 
 namespace QtTox
 {
 
+class AvatarCache;
+class FileReceiveSink;
+class FileSendSource;
+class SendqControl;
+struct SendqChunk;
+class TransferJournal;
+class TransferMonitor;
+class TransferScheduler;
+
 QByteArray hash(const QByteArray& data);
+QByteArray hashFile(const QString& path);
 
 class Files : public QObject
 {
@@ -76,11 +93,17 @@ public:
         FriendNotConnected,
         NameTooLong,
         TooMany,
+        OpenFailed,
     };
 
     uint32_t fileSend(uint32_t friendNum, FileKind kind, uint64_t file_size, const QByteArray& fileId,
             const QString& filename, ErrFileSend* err = nullptr);
 
+    // Send a file from disk, chunk requests for it are answered internally
+    // and fileChunkRequest is not emitted
+    uint32_t fileSendFromDisk(uint32_t friendNum, FileKind kind, const QString& path,
+            const QByteArray& fileId, const QString& filename, ErrFileSend* err = nullptr);
+
     enum class ErrFileSendChunk
     {
         Ok,
@@ -94,21 +117,133 @@ public:
         WrongPosition,
     };
 
-    bool fileSendChunk(uint32_t friendNum, uint32_t fileNum, uint32_t position,
+    // A chunk toxcore can't queue yet is kept and resent from iterate(), so
+    // Sendq is never reported and the call succeeds
+    bool fileSendChunk(uint32_t friendNum, uint32_t fileNum, uint64_t position,
             const QByteArray& data, ErrFileSendChunk* err = nullptr);
+    bool fileSendChunk(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+            const ChunkBuffer& data, ErrFileSendChunk* err = nullptr);
 
     Q_SIGNAL void fileChunkRequest(uint32_t friendNum, uint32_t fileNum, uint64_t position, size_t length);
 
+    // Scheduling of outgoing transfers: when enabled, chunk requests are
+    // queued and served from iterate(), avatars first, then data shared
+    // between friends by weight and capped by the bandwidth limit
+
+    struct TransferThroughput
+    {
+        uint64_t totalBytes;
+        uint64_t bytesPerSecond;
+    };
+
+    void setTransferScheduling(bool enabled);
+    void setSendBandwidthLimit(uint64_t bytesPerSecond);
+    void setFriendWeight(uint32_t friendNum, uint32_t weight);
+    TransferThroughput getSendThroughput(FileKind kind) const;
+
+    // Transfer instrumentation, the friend view includes finished transfers
+
+    struct TransferStats
+    {
+        uint64_t sentBytes = 0;
+        uint64_t sentChunks = 0;
+        uint64_t receivedBytes = 0;
+        uint64_t receivedChunks = 0;
+        uint64_t sendqRejects = 0;
+        uint64_t requestLatencyTotalNs = 0;
+        uint64_t requestLatencyMaxNs = 0;
+        uint64_t latencySamples = 0;
+        uint64_t stalls = 0;
+        uint64_t stallTotalNs = 0;
+    };
+
+    TransferStats getTransferStats(uint32_t friendNum, uint32_t fileNum) const;
+    TransferStats getFriendTransferStats(uint32_t friendNum) const;
+
     // File transmission: receiving
     
     Q_SIGNAL void fileReceived(uint32_t friendNum, uint32_t fileNum, FileKind kind,
             uint64_t fileSize, const QString& filename);
     Q_SIGNAL void fileChunkReceived(uint32_t friendNum, uint32_t fileNum, uint64_t position,
             const QByteArray& data);
+    // Same as fileChunkReceived with a pooled buffer, each signal only costs
+    // an allocation while something is connected to it
+    Q_SIGNAL void fileChunkBufferReceived(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+            const QtTox::ChunkBuffer& data);
+
+    enum class ErrFileReceiveTo
+    {
+        Ok,
+        NotFound,
+        UnknownSize,
+        OpenFailed,
+        MapFailed,
+    };
+
+    // Write the chunks of an announced transfer directly to path instead of
+    // emitting fileChunkReceived, only the final empty chunk is emitted
+    bool fileReceiveTo(uint32_t friendNum, uint32_t fileNum, const QString& path,
+            ErrFileReceiveTo* err = nullptr);
+
+    // Record the progress of transfers received with fileReceiveTo, known
+    // transfers are seeked to the first missing byte when offered again
+    bool openTransferJournal(const QString& path);
+    Q_SIGNAL void fileReceiveResumable(uint32_t friendNum, uint32_t fileNum,
+            uint64_t position, const QString& path);
+
+    // Avatars: with a cache, offered avatars that are cached already are
+    // canceled and reported by avatarReceived instead of fileReceived, new
+    // ones are cached and reported once complete. Larger avatars are
+    // reported by fileReceived without being cached
+
+    bool openAvatarCache(const QString& directory, uint64_t maxAvatarSize = DefaultMaxAvatarSize);
+    Q_SIGNAL void avatarReceived(uint32_t friendNum, const QByteArray& fileId,
+            const QByteArray& avatar);
+
+    // Send our avatar from the cache, its hash is computed once per change
+    uint32_t avatarSend(uint32_t friendNum, const QByteArray& avatar,
+            ErrFileSend* err = nullptr);
 
     Files(Tox *tox);
+    ~Files();
+
+    // Call after each Core::iterate() to serve scheduled chunk requests and
+    // resend chunks toxcore couldn't queue
+    void iterate();
+
+    // Hooks for the toxcore callbacks
+    bool handleFileChunkRequest(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+            size_t length);
+    bool handleFileReceive(uint32_t friendNum, uint32_t fileNum, FileKind kind,
+            uint64_t fileSize);
+    void handleFileReceiveChunk(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+            const uint8_t* data, size_t length);
+    void handleFileReceiveControl(uint32_t friendNum, uint32_t fileNum, FileControl control);
+
+private:
+    bool controlTransfer(uint32_t friendNum, uint32_t fileNum, FileControl control,
+            ErrFileControl* err = nullptr);
+    bool sendChunk(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+            const uint8_t* data, size_t length, ErrFileSendChunk* err);
+    void serveChunkRequest(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+            size_t length);
+    bool sendOrDefer(uint32_t friendNum, uint32_t fileNum, const SendqChunk& chunk,
+            const uint8_t* data, ErrFileSendChunk* err = nullptr);
+    ErrFileSendChunk resendChunk(quint64 key, const SendqChunk& chunk,
+                                 QVector<quint64>* unreadable);
+    void closeTransfer(quint64 key);
+
 private:
     struct Tox* tox;
+    std::unique_ptr<FileReceiveSink> receiveSink;
+    std::unique_ptr<FileSendSource> sendSource;
+    std::unique_ptr<SendqControl> sendq;
+    std::unique_ptr<TransferJournal> journal;
+    std::unique_ptr<TransferScheduler> scheduler;
+    std::unique_ptr<AvatarCache> avatarCache;
+    std::unique_ptr<TransferMonitor> monitor;
+    bool scheduling = false;
+    QHash<quint64, uint64_t> resumed;
 };
 
 }
@@ -0,0 +1,53 @@
+#ifndef _QT_TOX_LOSSY_COALESCER_H_
+#define _QT_TOX_LOSSY_COALESCER_H_
+
+#include "lowlevel.h"
+
+#include <QByteArray>
+#include <QHash>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace QtTox
+{
+
+class LossyCoalescer
+{
+public:
+    // packetId must be in the lossy custom packet range, 200 to 254
+    explicit LossyCoalescer(LowLevel* lowLevel, uint8_t packetId = 254);
+    LossyCoalescer(const LossyCoalescer& other) = delete;
+    LossyCoalescer& operator=(const LossyCoalescer& other) = delete;
+    ~LossyCoalescer();
+
+    bool send(uint32_t friendNum, const QByteArray& packet,
+            LowLevel::ErrFriendCustomPacket* err = nullptr);
+    void iterate();
+
+    uint64_t getPacketCount() const;
+    uint64_t getFrameCount() const;
+    uint64_t getDroppedCount() const;
+
+private:
+    struct Frame
+    {
+        QByteArray bytes;
+        int packets = 0;
+    };
+
+    void flush(uint32_t friendNum, Frame& frame);
+    void handleFrame(uint32_t friendNum, const uint8_t* data, size_t length);
+
+private:
+    LowLevel* lowLevel;
+    uint8_t packetId;
+    QHash<uint32_t, Frame> frames;
+    uint64_t packetCount = 0;
+    uint64_t frameCount = 0;
+    uint64_t dropped = 0;
+};
+
+}
+
+#endif // _QT_TOX_LOSSY_COALESCER_H_
@@ -1,17 +1,30 @@
 #ifndef _QT_TOX_LOW_LEVEL_H_
 #define _QT_TOX_LOW_LEVEL_H_
 
+#include <QHash>
 #include <QObject>
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
 struct Tox;
 
 namespace QtTox
 {
+
+class PacketCodec;
+
 class LowLevel : public QObject
 {
     Q_OBJECT
 
 public:
+    LowLevel(struct Tox* tox);
+    ~LowLevel();
+
     enum class ErrFriendCustomPacket
     {
         Ok,
@@ -25,13 +38,42 @@ public:
     };
 
     bool friendSendLossyPacket(uint32_t friendNum, const QByteArray& data, ErrFriendCustomPacket* err = nullptr);
+    bool friendSendLossyPacket(uint32_t friendNum, const uint8_t* data, size_t length,
+            ErrFriendCustomPacket* err = nullptr);
     bool friendSendLossLessPacket(uint32_t friendNum, const QByteArray& data, ErrFriendCustomPacket* err = nullptr);
-    Q_SIGNAL void friendSendLossyPacketReceived(uint32_t friendNum, const QByteArray& data);
-    Q_SIGNAL void friendSendLossLessPacketReceived(uint32_t friendNum, const QByteArray& data);
+    bool friendSendLossLessPacket(uint32_t friendNum, const uint8_t* data, size_t length,
+            ErrFriendCustomPacket* err = nullptr);
+
+    // Received custom packets are passed to the handler of their first byte,
+    // data points into toxcore's buffer and is valid during the call only
+    using PacketHandler = std::function<void(uint32_t friendNum, const uint8_t* data,
+            size_t length)>;
+    void setPacketHandler(uint8_t packetId, PacketHandler handler);
+    uint64_t getUnhandledPacketCount() const;
+
+    // Compression of lossless packets, per packet id. A friend's packets are
+    // compressed once both sides enabled the id with the same dictionary and
+    // exchanged it with negotiateCompression(). Id 191 is reserved for the
+    // control messages of the negotiation
+    struct CompressionStats
+    {
+        uint64_t packets;
+        uint64_t rawBytes;
+        uint64_t compressedBytes;
+        uint64_t compressNs;
+        uint64_t decompressNs;
+        uint64_t failures;
+    };
+
+    bool setCompression(uint8_t packetId, const QByteArray& dictionary, int threshold = 128);
+    bool clearCompression(uint8_t packetId);
+    void negotiateCompression(uint32_t friendNum);
+    void forgetFriend(uint32_t friendNum);
+    CompressionStats getCompressionStats() const;
 
     QByteArray getDhtId() const;
 
-    enum cass ErrGetPort
+    enum class ErrGetPort
     {
         Ok,
         NotBound,
@@ -40,8 +82,45 @@ public:
     uint16_t getSelfUdpPort(ErrGetPort* err = nullptr);
     uint16_t getSelfTcpPort(ErrGetPort* err = nullptr);
 
+    // Hook for the toxcore callbacks
+    void handlePacket(uint32_t friendNum, const uint8_t* data, size_t length);
+    // Passes a packet to its handler only, e.g. one unpacked from a lossy frame
+    void dispatch(uint32_t friendNum, const uint8_t* data, size_t length);
+
+private:
+    struct Negotiation
+    {
+        // bit n stands for packet id 160 + n
+        // our packets carry the trailer, announced with an enable message
+        uint32_t sending = 0;
+        // the friend's packets carry the trailer
+        uint32_t receiving = 0;
+        // dictionary the friend compresses each id with
+        std::array<uint32_t, 32> dictionaries = {};
+    };
+
+    PacketCodec* codecFor(uint32_t friendNum, uint8_t packetId) const;
+    PacketCodec* decoderFor(uint8_t packetId, uint32_t dictionaryId) const;
+    void replaceCodec(uint8_t packetId, std::unique_ptr<PacketCodec> codec);
+    bool sendControl(uint32_t friendNum, uint8_t type, uint8_t packetId);
+    void handleControl(uint32_t friendNum, const uint8_t* data, size_t length);
+
 private:
     struct Tox* tox;
+    std::array<PacketHandler, 256> handlers;
+    uint64_t unhandled = 0;
+    std::array<std::unique_ptr<PacketCodec>, 32> codecs;
+    // the previous codec of each id, for packets compressed before a friend
+    // learned about the change
+    std::array<std::unique_ptr<PacketCodec>, 32> retiredCodecs;
+    QHash<uint32_t, Negotiation> negotiations;
+    // decompressed packets during dispatch
+    QByteArray receiveBuffer;
+    // compressed packets being sent
+    QByteArray sendBuffer;
+    CompressionStats compressionStats = {};
 };
 
+}
+
 #endif // _QT_TOX_LOW_LEVEL_H_
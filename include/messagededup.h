@@ -0,0 +1,50 @@
+#ifndef _QT_TOX_MESSAGE_DEDUP_H_
+#define _QT_TOX_MESSAGE_DEDUP_H_
+
+#include <QElapsedTimer>
+#include <QVector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace QtTox
+{
+
+class MessageDedup
+{
+public:
+    MessageDedup(uint32_t windowMs, int capacity);
+
+    static uint64_t fingerprint(const uint8_t* key, size_t keyLength,
+            const uint8_t* text, size_t textLength);
+
+    bool isDuplicate(uint64_t fingerprint);
+    bool isDuplicate(const uint8_t* key, size_t keyLength,
+            const uint8_t* text, size_t textLength);
+    bool wasSeen(uint64_t fingerprint);
+    void record(uint64_t fingerprint);
+
+    uint64_t getSuppressedCount() const;
+    void clear();
+
+private:
+    bool contains(const QVector<uint64_t>& table, uint64_t fingerprint) const;
+    void insert(QVector<uint64_t>& table, uint64_t fingerprint);
+    void expire();
+    void rotate();
+
+private:
+    QVector<uint64_t> current;
+    QVector<uint64_t> previous;
+    QElapsedTimer timer;
+    qint64 rotatedAt = 0;
+    qint64 window;
+    int generationLimit;
+    int currentCount = 0;
+    uint64_t mask;
+    uint64_t suppressed = 0;
+};
+
+}
+
+#endif // _QT_TOX_MESSAGE_DEDUP_H_
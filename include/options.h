@@ -1,12 +1,17 @@
 #ifndef _TOX_OPTIONS_H_
 #define _TOX_OPTIONS_H_
 
+#include <QByteArray>
+#include <QString>
+
+#include <cstdint>
+
 namespace QtTox
 {
 
 class Options
 {
-
+public:
     enum class ToxProxyType
     {
         None,
@@ -30,6 +35,43 @@ class Options
         Error,
     };
 
+    bool getIpv6Enabled() const;
+    void setIpv6Enabled(bool enabled);
+
+    bool getUdpEnabled() const;
+    void setUdpEnabled(bool enabled);
+
+    bool getLocalDiscoveryEnabled() const;
+    void setLocalDiscoveryEnabled(bool enabled);
+
+    ToxProxyType getProxyType() const;
+    QString getProxyHost() const;
+    uint16_t getProxyPort() const;
+    void setProxy(ToxProxyType type, const QString& host, uint16_t port);
+
+    uint16_t getStartPort() const;
+    uint16_t getEndPort() const;
+    void setPortRange(uint16_t start, uint16_t end);
+
+    uint16_t getTcpPort() const;
+    void setTcpPort(uint16_t port);
+
+    ToxSaveDataType getSavedataType() const;
+    QByteArray getSavedata() const;
+    void setSavedata(ToxSaveDataType type, const QByteArray& savedata);
+
+private:
+    bool ipv6Enabled = true;
+    bool udpEnabled = true;
+    bool localDiscoveryEnabled = true;
+    ToxProxyType proxyType = ToxProxyType::None;
+    QString proxyHost;
+    uint16_t proxyPort = 0;
+    uint16_t startPort = 0;
+    uint16_t endPort = 0;
+    uint16_t tcpPort = 0;
+    ToxSaveDataType savedataType = ToxSaveDataType::None;
+    QByteArray savedata;
 };
 
 }
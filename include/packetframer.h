@@ -0,0 +1,84 @@
+#ifndef _QT_TOX_PACKET_FRAMER_H_
+#define _QT_TOX_PACKET_FRAMER_H_
+
+#include "lowlevel.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QObject>
+#include <QVector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace QtTox
+{
+
+class PacketFramer : public QObject
+{
+    Q_OBJECT
+
+public:
+    // packetId must be in the lossless custom packet range, 160 to 191
+    explicit PacketFramer(LowLevel* lowLevel, uint8_t packetId = 160,
+            int maxPendingBytes = 64 * 1024 * 1024);
+    ~PacketFramer();
+
+    uint16_t send(uint32_t friendNum, const QByteArray& payload);
+    uint16_t getNextMessageId(uint32_t friendNum) const;
+    void iterate();
+    void forgetFriend(uint32_t friendNum);
+
+    void handlePacket(uint32_t friendNum, const uint8_t* data, size_t length);
+
+    int getPendingCount() const;
+    uint64_t getDroppedCount() const;
+
+    Q_SIGNAL void messageReceived(uint32_t friendNum, const QByteArray& payload);
+    Q_SIGNAL void messageSent(uint32_t friendNum, uint16_t messageId);
+    Q_SIGNAL void messageFailed(uint32_t friendNum, uint16_t messageId,
+            LowLevel::ErrFriendCustomPacket err);
+
+private:
+    struct Outgoing
+    {
+        uint16_t messageId;
+        QByteArray payload;
+        int offset;
+    };
+
+    struct Incoming
+    {
+        QByteArray payload;
+        int received;
+    };
+
+    struct Result
+    {
+        uint32_t friendNum;
+        uint16_t messageId;
+        LowLevel::ErrFriendCustomPacket err;
+    };
+
+    void flush(uint32_t friendNum, QVector<Result>& results);
+    bool sendFragment(uint32_t friendNum, Outgoing& message,
+            LowLevel::ErrFriendCustomPacket* err);
+    void drop(uint32_t friendNum, quint64 key);
+    void report(const QVector<Result>& results);
+
+private:
+    LowLevel* lowLevel;
+    uint8_t packetId;
+    int maxPendingBytes;
+    QByteArray packet;
+    QHash<uint32_t, uint16_t> nextMessageId;
+    QHash<uint32_t, QList<Outgoing>> outgoing;
+    QHash<quint64, Incoming> incoming;
+    QHash<uint32_t, qint64> pendingBytes;
+    uint64_t dropped = 0;
+};
+
+}
+
+#endif // _QT_TOX_PACKET_FRAMER_H_
@@ -0,0 +1,47 @@
+#ifndef _QT_TOX_PROFILE_LOADER_H_
+#define _QT_TOX_PROFILE_LOADER_H_
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <future>
+
+namespace QtTox
+{
+
+class StartupReport;
+
+class ProfileLoader
+{
+public:
+    explicit ProfileLoader(StartupReport* report = nullptr);
+    ProfileLoader(const ProfileLoader& other) = delete;
+    ProfileLoader& operator=(const ProfileLoader& other) = delete;
+    ~ProfileLoader();
+
+    enum class ErrLoad
+    {
+        Ok,
+        AlreadyStarted,
+        OpenFailed,
+        Empty,
+        MapFailed,
+        Decrypt,
+    };
+
+    bool start(const QString& path, const QString& password, ErrLoad* err = nullptr);
+    bool isEncrypted() const;
+    QByteArray takeSavedata(ErrLoad* err = nullptr);
+
+private:
+    StartupReport* report;
+    QFile file;
+    uchar* mapped = nullptr;
+    bool encrypted = false;
+    std::future<QByteArray> decrypted;
+};
+
+}
+
+#endif // _QT_TOX_PROFILE_LOADER_H_
@@ -0,0 +1,79 @@
+#ifndef _QT_TOX_REALTIME_CHANNEL_H_
+#define _QT_TOX_REALTIME_CHANNEL_H_
+
+#include "lowlevel.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+
+#include <bitset>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace QtTox
+{
+
+class RealtimeChannel
+{
+public:
+    struct LinkQuality
+    {
+        // rolling averages, recent packets weigh most
+        double lossRate;
+        double lateRate;
+        double jitterMs;
+        // totals since the first packet, late includes the reordered packets
+        // that were counted as lost first and are not lost anymore
+        uint64_t received;
+        uint64_t lost;
+        uint64_t late;
+        uint64_t reordered;
+    };
+
+    // packetId must be in the lossy custom packet range, 200 to 254
+    explicit RealtimeChannel(LowLevel* lowLevel, uint8_t packetId = 253);
+    RealtimeChannel(const RealtimeChannel& other) = delete;
+    RealtimeChannel& operator=(const RealtimeChannel& other) = delete;
+    ~RealtimeChannel();
+
+    bool send(uint32_t friendNum, const QByteArray& payload,
+            LowLevel::ErrFriendCustomPacket* err = nullptr);
+
+    // Called for packets newer than all before, data is valid during the call only
+    using Handler = std::function<void(uint32_t friendNum, uint32_t sequence,
+            const uint8_t* data, size_t length)>;
+    void setHandler(Handler handler);
+
+    LinkQuality getLinkQuality(uint32_t friendNum) const;
+    void forgetFriend(uint32_t friendNum);
+
+private:
+    struct Peer
+    {
+        LinkQuality quality;
+        uint32_t lastSequence;
+        qint64 lastTransit;
+        // sender clock unwrapped to 64 bits
+        uint32_t lastSentAt;
+        qint64 senderTime;
+        // bit n is set while lastSequence - n is missing
+        std::bitset<256> missing;
+    };
+
+    void handlePacket(uint32_t friendNum, const uint8_t* data, size_t length);
+
+private:
+    LowLevel* lowLevel;
+    uint8_t packetId;
+    Handler handler;
+    QElapsedTimer clock;
+    QByteArray packet;
+    QHash<uint32_t, uint32_t> nextSequence;
+    QHash<uint32_t, Peer> peers;
+};
+
+}
+
+#endif // _QT_TOX_REALTIME_CHANNEL_H_
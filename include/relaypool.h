@@ -0,0 +1,89 @@
+#ifndef _QT_TOX_RELAY_POOL_H_
+#define _QT_TOX_RELAY_POOL_H_
+
+#include "connection.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+#include <cstdint>
+
+namespace QtTox
+{
+
+class Core;
+
+class RelayPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Relay
+    {
+        QString address;
+        uint16_t port;
+        QByteArray publicKey;
+    };
+
+    struct RelayHealth
+    {
+        Relay relay;
+        bool active;
+        // times the instance came online over TCP while the relay was active
+        uint32_t successes;
+        // times the relay was rotated out as dead
+        uint32_t strikes;
+    };
+
+    struct Health
+    {
+        Connection self;
+        int activeRelays;
+        int friendsUdp;
+        int friendsTcp;
+        int friendsOffline;
+        uint64_t tcpDrops;
+        uint64_t tcpToUdp;
+        uint64_t rotations;
+    };
+
+    RelayPool(Core* core, int activeCount = 3, int deadAfterMs = 60000);
+
+    void addRelay(const Relay& relay);
+    Health getHealth() const;
+    QVector<RelayHealth> getRelays() const;
+
+    Q_SIGNAL void relayRotated(const Relay& dead, const Relay& replacement);
+
+private:
+    void fill();
+    int activateNext();
+    void check();
+    void rotate();
+    void onSelfConnectionChanged(Connection status);
+    void onFriendConnectionChanged(uint32_t friendNum, Connection status);
+    void pruneFriends();
+
+private:
+    Core* core;
+    int activeCount;
+    int deadAfter;
+    QVector<RelayHealth> relays;
+    QHash<uint32_t, Connection> friends;
+    Connection self = Connection::None;
+    QElapsedTimer offlineSince;
+    QElapsedTimer lastRotation;
+    QTimer timer;
+    uint64_t tcpDrops = 0;
+    uint64_t tcpToUdp = 0;
+    uint64_t rotations = 0;
+};
+
+}
+
+#endif // _QT_TOX_RELAY_POOL_H_
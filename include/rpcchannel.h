@@ -0,0 +1,88 @@
+#ifndef _QT_TOX_RPC_CHANNEL_H_
+#define _QT_TOX_RPC_CHANNEL_H_
+
+#include "packetframer.h"
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QQueue>
+#include <QVector>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace QtTox
+{
+
+class LowLevel;
+
+class RpcChannel : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum class ErrCall
+    {
+        Ok,
+        Timeout,
+        SendFailed,
+        NoMethod,
+        Disconnected,
+    };
+
+    using Callback = std::function<void(ErrCall err, const QByteArray& response)>;
+
+    // packetId must be in the lossless custom packet range, 160 to 191
+    RpcChannel(LowLevel* lowLevel, uint8_t packetId = 161, int timeoutMs = 10000);
+    ~RpcChannel();
+
+    uint32_t call(uint32_t friendNum, uint16_t method, const QByteArray& request,
+            Callback callback);
+    void respond(uint32_t friendNum, uint32_t requestId, const QByteArray& response);
+
+    // Requests for methods without a handler are answered with NoMethod
+    using Handler = std::function<void(uint32_t friendNum, uint32_t requestId,
+            const QByteArray& request)>;
+    void setMethodHandler(uint16_t method, Handler handler);
+
+    void iterate();
+    void forgetFriend(uint32_t friendNum);
+
+    int getPendingCount() const;
+
+private:
+    struct Pending
+    {
+        Callback callback;
+        qint64 deadline;
+    };
+
+    struct Deadline
+    {
+        qint64 deadline;
+        quint64 key;
+    };
+
+    void handleMessage(uint32_t friendNum, const QByteArray& message);
+    void handleFailure(uint32_t friendNum, uint16_t messageId);
+    void finish(quint64 key, ErrCall err, const QByteArray& response);
+    void reply(uint32_t friendNum, uint32_t requestId, uint8_t kind,
+            const QByteArray& response);
+
+private:
+    std::unique_ptr<PacketFramer> framer;
+    int timeout;
+    QElapsedTimer clock;
+    QHash<uint32_t, uint32_t> nextRequestId;
+    QHash<quint64, Pending> pending;
+    QQueue<Deadline> deadlines;
+    QHash<quint64, quint64> requestOfMessage;
+    QHash<uint16_t, Handler> handlers;
+};
+
+}
+
+#endif // _QT_TOX_RPC_CHANNEL_H_
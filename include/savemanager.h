@@ -0,0 +1,61 @@
+#ifndef _QT_TOX_SAVE_MANAGER_H_
+#define _QT_TOX_SAVE_MANAGER_H_
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <memory>
+
+struct Tox;
+
+namespace QtTox
+{
+
+class ToxEncrypt;
+
+class SaveManager : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Connect the savedataChanged() signals of ChatList and Self to markDirty()
+    SaveManager(struct Tox* tox, const QString& path, int debounceMs = 1000);
+    ~SaveManager();
+
+    void setToxEncrypt(std::unique_ptr<ToxEncrypt> encrypt);
+
+    void markDirty();
+    bool isDirty() const;
+    bool flush();
+
+    // Emitted from a worker thread after each background save
+    Q_SIGNAL void saved(bool success);
+
+private:
+    void save();
+    void finishSave();
+    QByteArray savedata() const;
+    static bool write(const QString& path, const QByteArray& savedata,
+            const std::shared_ptr<const ToxEncrypt>& encrypt);
+
+private:
+    struct Tox* tox;
+    QString path;
+    int debounce;
+    QTimer timer;
+    QElapsedTimer dirtySince;
+    bool dirty = false;
+    QAtomicInt writing;
+    QAtomicInt failed;
+    QThreadPool pool;
+    std::shared_ptr<const ToxEncrypt> encrypt;
+};
+
+}
+
+#endif // _QT_TOX_SAVE_MANAGER_H_
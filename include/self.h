@@ -1,6 +1,13 @@
 #ifndef _QT_TOX_SELF_H_
 #define _QT_TOX_SELF_H_
 
+#include "connection.h"
+#include "userstatus.h"
+
+#include <QByteArray>
+#include <QObject>
+#include <QString>
+
 struct Tox;
 
 namespace QtTox
@@ -11,6 +18,8 @@ class Self : public QObject
     Q_OBJECT
 
 public:
+    Self(struct Tox* tox);
+
     Connection getSelfConnectionStatus() const;
     Q_SIGNAL void selfConnectionStatusChanged(Connection status);
 
@@ -34,14 +43,19 @@ public:
     bool setSelfName(const QString& name, ErrSetInfo* err = nullptr);
     QString getSelfName() const;
 
-    bool setSelfStatusMessage(const QString& statusMessage, ErrSetInfo* err = nullptr)
+    bool setSelfStatusMessage(const QString& statusMessage, ErrSetInfo* err = nullptr);
     QString getSelfStatusMessage() const;
 
     bool setSelfStatus(UserStatus status);
     UserStatus getSelfStatus() const;
 
+    // Emitted after a change that is part of the savedata
+    Q_SIGNAL void savedataChanged();
+
 private:
     struct Tox* tox;
+};
+
 }
 
 #endif // _QT_TOX_SELF_H_
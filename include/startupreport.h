@@ -0,0 +1,50 @@
+#ifndef _QT_TOX_STARTUP_REPORT_H_
+#define _QT_TOX_STARTUP_REPORT_H_
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+
+#include <cstdint>
+
+namespace QtTox
+{
+
+class StartupReport
+{
+public:
+    struct Phase
+    {
+        QString name;
+        // nanoseconds since the report was created
+        qint64 startNs;
+        qint64 durationNs;
+        // phases on the same thread share a number, the creating thread is 0
+        int thread;
+    };
+
+    StartupReport();
+
+    qint64 now() const;
+    void record(const QString& name, qint64 startNs);
+
+    QVector<Phase> getPhases() const;
+    qint64 getTotalNs() const;
+    int getDroppedCount() const;
+    QString toText() const;
+    QByteArray toTraceJson() const;
+    bool writeTrace(const QString& path) const;
+
+private:
+    QElapsedTimer clock;
+    mutable QMutex mutex;
+    QVector<Phase> phases;
+    int dropped = 0;
+    QVector<Qt::HANDLE> threads;
+};
+
+}
+
+#endif // _QT_TOX_STARTUP_REPORT_H_
@@ -21,9 +21,13 @@
 
 #include <QByteArray>
 #include <QString>
+#include <QVector>
 
+#include <cstdint>
+#include <future>
 #include <memory>
 
+class QIODevice;
 struct Tox_Pass_Key;
 
 namespace QtTox
@@ -44,14 +48,42 @@ public:
     static std::unique_ptr<ToxEncrypt> makeToxEncrypt(const QString& password);
     static std::unique_ptr<ToxEncrypt> makeToxEncrypt(const QString& password,
                                                       const QByteArray& toxSave);
+    static std::future<QByteArray> encryptPassAsync(const QString& password,
+                                                    const QByteArray& plaintext);
+    static std::future<QByteArray> decryptPassAsync(const QString& password,
+                                                    const QByteArray& ciphertext);
+    static std::future<std::unique_ptr<ToxEncrypt>> makeToxEncryptAsync(const QString& password);
+    static std::future<std::unique_ptr<ToxEncrypt>> makeToxEncryptAsync(const QString& password,
+                                                                        const QByteArray& toxSave);
+    static void clearKeyCache();
     QByteArray encrypt(const QByteArray& plaintext) const;
     QByteArray decrypt(const QByteArray& ciphertext) const;
 
+    struct Batch
+    {
+        // record i is data.mid(offsets[i], offsets[i + 1] - offsets[i])
+        QByteArray data;
+        QVector<int> offsets;
+        // false for records that failed, their range holds no valid data
+        QVector<bool> ok;
+    };
+
+    Batch encryptMany(const QVector<QByteArray>& records) const;
+    Batch decryptMany(const QVector<QByteArray>& records) const;
+    bool encryptStream(QIODevice& in, QIODevice& out, int chunkSize = 64 * 1024) const;
+    bool decryptStream(QIODevice& in, QIODevice& out) const;
+    QByteArray decryptStreamChunk(QIODevice& in, uint64_t index) const;
+
 private:
-    explicit ToxEncrypt(Tox_Pass_Key* key);
+    explicit ToxEncrypt(std::shared_ptr<Tox_Pass_Key> key);
+    Batch processMany(const QVector<QByteArray>& records, bool encrypting) const;
+    bool sealChunk(const char* tag, uint64_t index, bool final, QByteArray& plain, int length,
+                   QByteArray& sealed) const;
+    bool openChunk(const QByteArray& sealed, int length, const char* tag, uint64_t index,
+                   bool* final, QByteArray& plain) const;
 
 private:
-    Tox_Pass_Key* passKey = nullptr;
+    std::shared_ptr<Tox_Pass_Key> passKey;
 };
 
 }
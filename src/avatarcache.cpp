@@ -0,0 +1,180 @@
+#include "avatarcache.h"
+
+#include "files.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+
+#include <tox/tox.h>
+
+#include <cstring>
+
+namespace QtTox
+{
+
+/**
+ * @class AvatarCache
+ * @brief On-disk cache of avatars keyed by their file ID.
+ *
+ * The file ID of an avatar transfer is the hash of the avatar, so an avatar
+ * that is already cached doesn't have to be downloaded again. Each avatar
+ * is stored in its own file named after the hex encoded file ID.
+ */
+
+/**
+ * @param maxAvatarSize Larger avatar transfers are not cached. toxcore sets
+ * no limit, the cap is the client's policy.
+ */
+AvatarCache::AvatarCache(uint64_t maxAvatarSize)
+    : maxAvatarSize{maxAvatarSize}
+{
+}
+
+/**
+ * @brief Uses the given directory as cache, creating it if needed.
+ * @return False if the directory can't be created.
+ */
+bool AvatarCache::open(const QString& directory)
+{
+    QDir dir{directory};
+    if (!dir.mkpath(QStringLiteral("."))) {
+        qWarning() << "Can't create avatar cache" << directory;
+        return false;
+    }
+
+    this->directory = dir.absolutePath();
+    known.clear();
+    for (const auto& name : dir.entryList(QDir::Files)) {
+        const auto fileId = QByteArray::fromHex(name.toLatin1());
+        if (fileId.size() == TOX_HASH_LENGTH) {
+            known.insert(fileId);
+        }
+    }
+
+    return true;
+}
+
+bool AvatarCache::contains(const QByteArray& fileId) const
+{
+    return known.contains(fileId);
+}
+
+/**
+ * @brief Reads a cached avatar.
+ * @return The avatar or an empty QByteArray if it can't be read.
+ */
+QByteArray AvatarCache::load(const QByteArray& fileId) const
+{
+    QFile file{path(fileId)};
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    return file.readAll();
+}
+
+/**
+ * @brief Adds an avatar to the cache.
+ * @return Path of the cached avatar, empty on failure.
+ */
+QString AvatarCache::store(const QByteArray& fileId, const QByteArray& avatar)
+{
+    const auto filePath = path(fileId);
+    if (known.contains(fileId)) {
+        return filePath;
+    }
+
+    QSaveFile file{filePath};
+    if (!file.open(QIODevice::WriteOnly) || file.write(avatar) != avatar.size()
+            || !file.commit()) {
+        qWarning() << "Can't write avatar" << filePath << file.errorString();
+        return {};
+    }
+
+    known.insert(fileId);
+    return filePath;
+}
+
+/**
+ * @brief Gets the hash of our own avatar, computing it only when it changed.
+ */
+QByteArray AvatarCache::ownHash(const QByteArray& avatar)
+{
+    if (ownAvatarHash.isEmpty() || avatar != ownAvatar) {
+        ownAvatar = avatar;
+        ownAvatarHash = hash(avatar);
+    }
+
+    return ownAvatarHash;
+}
+
+/**
+ * @brief Starts collecting an avatar that is not cached yet.
+ */
+void AvatarCache::begin(quint64 key, const QByteArray& fileId, uint64_t size)
+{
+    if (directory.isEmpty() || size == 0 || size > maxAvatarSize) {
+        return;
+    }
+
+    auto download = Download{fileId, QByteArray{}};
+    download.data.reserve(static_cast<int>(size));
+    downloads.insert(key, download);
+}
+
+void AvatarCache::append(quint64 key, uint64_t position, const uint8_t* data, size_t length)
+{
+    auto it = downloads.find(key);
+    if (it == downloads.end()) {
+        return;
+    }
+
+    if (position + length > maxAvatarSize) {
+        downloads.erase(it);
+        return;
+    }
+
+    auto& avatar = it->data;
+    const auto end = static_cast<int>(position + length);
+    if (avatar.size() < end) {
+        avatar.resize(end);
+    }
+
+    memcpy(avatar.data() + position, data, length);
+}
+
+/**
+ * @brief Completes an avatar download and caches it if the hash matches.
+ * @return True if the avatar was cached.
+ */
+bool AvatarCache::finish(quint64 key, QByteArray* fileId, QByteArray* avatar)
+{
+    auto it = downloads.find(key);
+    if (it == downloads.end()) {
+        return false;
+    }
+
+    const auto download = *it;
+    downloads.erase(it);
+    if (hash(download.data) != download.fileId || store(download.fileId, download.data).isEmpty()) {
+        return false;
+    }
+
+    *fileId = download.fileId;
+    *avatar = download.data;
+    return true;
+}
+
+void AvatarCache::drop(quint64 key)
+{
+    downloads.remove(key);
+}
+
+QString AvatarCache::path(const QByteArray& fileId) const
+{
+    return directory + QLatin1Char('/') + QString::fromLatin1(fileId.toHex());
+}
+
+}
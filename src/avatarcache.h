@@ -0,0 +1,54 @@
+#ifndef _QT_TOX_AVATAR_CACHE_H_
+#define _QT_TOX_AVATAR_CACHE_H_
+
+#include "common.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QSet>
+#include <QString>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace QtTox
+{
+
+class AvatarCache
+{
+public:
+    explicit AvatarCache(uint64_t maxAvatarSize = DefaultMaxAvatarSize);
+
+    bool open(const QString& directory);
+
+    bool contains(const QByteArray& fileId) const;
+    QByteArray load(const QByteArray& fileId) const;
+    QString store(const QByteArray& fileId, const QByteArray& avatar);
+    QByteArray ownHash(const QByteArray& avatar);
+
+    void begin(quint64 key, const QByteArray& fileId, uint64_t size);
+    void append(quint64 key, uint64_t position, const uint8_t* data, size_t length);
+    bool finish(quint64 key, QByteArray* fileId, QByteArray* avatar);
+    void drop(quint64 key);
+
+private:
+    struct Download
+    {
+        QByteArray fileId;
+        QByteArray data;
+    };
+
+    QString path(const QByteArray& fileId) const;
+
+private:
+    uint64_t maxAvatarSize;
+    QString directory;
+    QSet<QByteArray> known;
+    QHash<quint64, Download> downloads;
+    QByteArray ownAvatar;
+    QByteArray ownAvatarHash;
+};
+
+}
+
+#endif // _QT_TOX_AVATAR_CACHE_H_
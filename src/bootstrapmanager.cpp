@@ -0,0 +1,300 @@
+#include "bootstrapmanager.h"
+
+#include "core.h"
+#include "self.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+
+#include <algorithm>
+
+namespace
+{
+
+const quint32 CacheMagic = 0x51544231; // "QTB1"
+const int MaxCachedNodes = 64;
+// a connection this soon after a wave switch is credited to the previous wave
+const int GraceMs = 1000;
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class BootstrapManager
+ * @brief Bootstraps from several nodes at once, best known nodes first.
+ *
+ * Nodes are tried in waves of a few nodes bootstrapped together. If the
+ * instance isn't online when a wave times out, the next wave follows, the
+ * list wraps around until a wave succeeds. toxcore doesn't tell which node
+ * answered, so the nodes of the wave that brought the instance online share
+ * the success and the time it took, the nodes of earlier waves count a
+ * failure. A connection that comes within a grace period after a wave
+ * switch is most likely the work of the previous wave, so it is credited
+ * to that wave and the new wave counts neither way. The resulting ranking
+ * is saved to the cache file and the next start begins with the nodes that
+ * came online fastest.
+ */
+
+/**
+ * @param core Instance to bootstrap, has to outlive the manager.
+ * @param cachePath File the node ranking is kept in between starts.
+ * @param parallel Number of nodes bootstrapped in one wave.
+ * @param waveTimeoutMs Time to wait for a wave before trying the next.
+ */
+BootstrapManager::BootstrapManager(Core* core, const QString& cachePath, int parallel,
+        int waveTimeoutMs)
+    : core{core}
+    , cachePath{cachePath}
+    , parallel{std::max(parallel, 1)}
+    , waveTimeout{waveTimeoutMs}
+{
+    connect(core->getSelf(), &Self::selfConnectionStatusChanged,
+            this, &BootstrapManager::onConnectionChanged);
+    connect(&timer, &QTimer::timeout, this, &BootstrapManager::nextWave);
+    loadCache();
+}
+
+/**
+ * @brief Adds nodes to the candidates, nodes from the cache keep their stats.
+ */
+void BootstrapManager::setNodes(const QVector<Node>& nodes)
+{
+    for (const auto& node : nodes) {
+        const auto index = findNode(node);
+        if (index < 0) {
+            this->nodes.append(NodeStats{node, -1, 0, 0});
+        } else {
+            this->nodes[index].node.tcpPort = node.tcpPort;
+        }
+    }
+
+    // ranking reorders the nodes, a running wave refers to them by index
+    if (!timer.isActive()) {
+        rank();
+    }
+}
+
+/**
+ * @brief Starts bootstrapping with the first wave.
+ */
+void BootstrapManager::start()
+{
+    if (nodes.isEmpty()) {
+        return;
+    }
+
+    rank();
+    wave.clear();
+    previousWave.clear();
+    nextNode = 0;
+    sinceStart.start();
+    nextWave();
+    timer.start(waveTimeout);
+}
+
+bool BootstrapManager::isOnline() const
+{
+    return connected;
+}
+
+/**
+ * @brief Candidate nodes in the order they are tried.
+ */
+QVector<BootstrapManager::NodeStats> BootstrapManager::getRanking() const
+{
+    return nodes;
+}
+
+/**
+ * @brief Writes the best ranked nodes to the cache file.
+ */
+bool BootstrapManager::saveCache() const
+{
+    QSaveFile file{cachePath};
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    const auto count = std::min(nodes.size(), MaxCachedNodes);
+    QDataStream out{&file};
+    out.setVersion(QDataStream::Qt_5_0);
+    out << CacheMagic << static_cast<quint32>(count);
+    for (auto i = 0; i < count; ++i) {
+        const auto& stats = nodes[i];
+        out << stats.node.address << static_cast<quint16>(stats.node.port)
+            << stats.node.publicKey << static_cast<quint16>(stats.node.tcpPort)
+            << static_cast<qint64>(stats.latencyMs) << static_cast<quint32>(stats.successes)
+            << static_cast<quint32>(stats.failures);
+    }
+
+    if (out.status() != QDataStream::Ok) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+void BootstrapManager::loadCache()
+{
+    QFile file{cachePath};
+    if (!file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+
+    QDataStream in{&file};
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    quint32 count = 0;
+    in >> magic >> count;
+    if (magic != CacheMagic) {
+        qWarning() << "Ignoring invalid bootstrap node cache" << cachePath;
+        return;
+    }
+
+    for (quint32 i = 0; i < count && i < static_cast<quint32>(MaxCachedNodes); ++i) {
+        NodeStats stats;
+        quint16 port = 0;
+        quint16 tcpPort = 0;
+        qint64 latency = 0;
+        quint32 successes = 0;
+        quint32 failures = 0;
+        in >> stats.node.address >> port >> stats.node.publicKey >> tcpPort >> latency
+           >> successes >> failures;
+        if (in.status() != QDataStream::Ok) {
+            break;
+        }
+
+        stats.node.port = port;
+        stats.node.tcpPort = tcpPort;
+        stats.latencyMs = latency;
+        stats.successes = successes;
+        stats.failures = failures;
+        if (findNode(stats.node) < 0) {
+            nodes.append(stats);
+        }
+    }
+}
+
+void BootstrapManager::nextWave()
+{
+    if (connected) {
+        timer.stop();
+        return;
+    }
+
+    // the grace period of the previous wave passed without a connection
+    blame(previousWave);
+    previousWave = wave;
+    sincePreviousWave = sinceWave;
+    wave.clear();
+    const auto count = std::min(parallel, nodes.size());
+    for (auto i = 0; i < count; ++i) {
+        if (nextNode >= nodes.size()) {
+            nextNode = 0;
+        }
+
+        wave.append(nextNode);
+        const auto& node = nodes[nextNode].node;
+        core->bootstrap(node.address, node.port, node.publicKey);
+        if (node.tcpPort) {
+            core->addTcpReleay(node.address, node.tcpPort, node.publicKey);
+        }
+
+        ++nextNode;
+    }
+
+    sinceWave.start();
+}
+
+void BootstrapManager::onConnectionChanged(Connection status)
+{
+    if (status == Connection::None) {
+        // toxcore reconnects through the DHT it already knows
+        connected = false;
+        return;
+    }
+
+    if (connected) {
+        return;
+    }
+
+    connected = true;
+    if (!sinceStart.isValid() || wave.isEmpty()) {
+        return;
+    }
+
+    timer.stop();
+    if (!previousWave.isEmpty() && sinceWave.elapsed() < std::min(GraceMs, waveTimeout / 2)) {
+        credit(previousWave, sincePreviousWave.elapsed());
+    } else {
+        blame(previousWave);
+        credit(wave, sinceWave.elapsed());
+    }
+
+    wave.clear();
+    previousWave.clear();
+    rank();
+    if (!saveCache()) {
+        qWarning() << "Can't write bootstrap node cache" << cachePath;
+    }
+
+    emit online(sinceStart.elapsed());
+}
+
+void BootstrapManager::credit(const QVector<int>& indices, qint64 latency)
+{
+    for (const auto index : indices) {
+        auto& stats = nodes[index];
+        ++stats.successes;
+        stats.failures /= 2;
+        stats.latencyMs = stats.latencyMs < 0 ? latency : (3 * stats.latencyMs + latency) / 4;
+    }
+}
+
+void BootstrapManager::blame(QVector<int>& indices)
+{
+    for (const auto index : indices) {
+        ++nodes[index].failures;
+    }
+
+    indices.clear();
+}
+
+/**
+ * @brief Orders the nodes by expected time to come online.
+ *
+ * Nodes that never succeeded are assumed to take a whole wave timeout, each
+ * recent failure adds another one.
+ */
+void BootstrapManager::rank()
+{
+    const auto timeout = static_cast<qint64>(waveTimeout);
+    const auto cost = [timeout](const NodeStats& stats) {
+        const auto latency = stats.latencyMs < 0 ? timeout : stats.latencyMs;
+        return latency + timeout * stats.failures;
+    };
+
+    std::stable_sort(nodes.begin(), nodes.end(), [&cost](const NodeStats& a, const NodeStats& b) {
+        return cost(a) < cost(b);
+    });
+}
+
+int BootstrapManager::findNode(const Node& node) const
+{
+    for (auto i = 0; i < nodes.size(); ++i) {
+        const auto& known = nodes[i].node;
+        if (known.publicKey == node.publicKey && known.address == node.address
+                && known.port == node.port) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+}
@@ -126,6 +126,10 @@ uint32_t ChatList::friendAdd(const QByteArray& address, const QString& message,
             cMessage.size(), &toxErr);
 
     fillErrFriendAdd(toxErr, err);
+    if (friendNum != UINT32_MAX) {
+        emit savedataChanged();
+    }
+
     return friendNum;
 }
 
@@ -136,6 +140,10 @@ uint32_t ChatList::friendAddNorequest(const QByteArray& address, ErrFriendAdd* e
             &toxErr);
 
     fillErrFriendAdd(toxErr, err);
+    if (friendNum != UINT32_MAX) {
+        emit savedataChanged();
+    }
+
     return friendNum;
 }
 
@@ -144,6 +152,10 @@ bool ChatList::friendDelete(uint32_t friendNum, ErrFriendDelete* err)
     TOX_ERR_FRIEND_DELETE toxErr;
     const auto success = tox_friend_delete(tox, friendNum, &toxErr);
     fillErrFriendDelete(toxErr, err);
+    if (success) {
+        emit savedataChanged();
+    }
+
     return success;
 }
 
@@ -175,6 +187,10 @@ uint32_t ChatList::conferenceNew(ErrConferenceNew* err)
     TOX_ERR_CONFERENCE_NEW toxErr;
     const auto conferenceNum = tox_conference_new(tox, &toxErr);
     fillErrConferenceNew(toxErr, err);
+    if (conferenceNum != UINT32_MAX) {
+        emit savedataChanged();
+    }
+
     return conferenceNum;
 }
 
@@ -183,6 +199,10 @@ bool ChatList::conferenceDelete(uint32_t conferenceNum, ErrConferenceDelete* err
     TOX_ERR_CONFERENCE_DELETE toxErr;
     const auto success = tox_conference_delete(tox, conferenceNum, &toxErr);
     fillErrConferenceDelete(toxErr, err);
+    if (success) {
+        emit savedataChanged();
+    }
+
     return success;
 }
 
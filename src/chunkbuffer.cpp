@@ -0,0 +1,325 @@
+#include "chunkbuffer.h"
+
+#include <QVector>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace
+{
+
+struct SlabPool;
+
+}
+
+namespace QtTox
+{
+
+struct ChunkSlab
+{
+    std::atomic<int> ref;
+    size_t size;
+    size_t capacity;
+    // pool the slab returns to, nullptr for oversized slabs
+    SlabPool* pool;
+    // link in the return stack of the pool
+    ChunkSlab* next;
+
+    uint8_t* bytes()
+    {
+        return reinterpret_cast<uint8_t*>(this + 1);
+    }
+};
+
+}
+
+namespace
+{
+
+using QtTox::ChunkBuffer;
+using QtTox::ChunkSlab;
+
+// free slabs kept per pool, anything above is returned to the allocator
+const int MaxFreeSlabs = 256;
+
+std::atomic<uint64_t> allocations{0};
+std::atomic<uint64_t> reuses{0};
+
+/*
+ * Every thread that allocates buffers owns one pool. A slab always returns
+ * to the pool it came from: on the owning thread to the free list, on other
+ * threads to a lock-free stack the owner drains once its free list is
+ * empty. A producer thread handing chunks to a consumer thread therefore
+ * gets its slabs back instead of allocating new ones. The pool outlives
+ * its thread for as long as slabs from it are alive.
+ */
+struct SlabPool
+{
+    // one for the owning thread plus one per slab allocated from the pool
+    std::atomic<int> refs{1};
+    std::atomic<bool> orphaned{false};
+    std::atomic<ChunkSlab*> returned{nullptr};
+    // touched by the owning thread only
+    QVector<ChunkSlab*> slabs;
+};
+
+void unrefPool(SlabPool* pool)
+{
+    if (pool->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete pool;
+    }
+}
+
+ChunkSlab* newSlab(size_t capacity, SlabPool* pool)
+{
+    ++allocations;
+    auto memory = std::malloc(sizeof(ChunkSlab) + capacity);
+    if (!memory) {
+        throw std::bad_alloc{};
+    }
+
+    auto slab = new (memory) ChunkSlab;
+    slab->capacity = capacity;
+    slab->pool = pool;
+    slab->next = nullptr;
+    if (pool) {
+        pool->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return slab;
+}
+
+void deleteSlab(ChunkSlab* slab)
+{
+    const auto pool = slab->pool;
+    slab->~ChunkSlab();
+    std::free(slab);
+    if (pool) {
+        unrefPool(pool);
+    }
+}
+
+void deleteSlabs(ChunkSlab* slab)
+{
+    while (slab) {
+        const auto next = slab->next;
+        deleteSlab(slab);
+        slab = next;
+    }
+}
+
+struct PoolHolder
+{
+    ~PoolHolder()
+    {
+        // slabs returned from here on are freed by the returning thread
+        pool->orphaned.store(true);
+        deleteSlabs(pool->returned.exchange(nullptr));
+        const auto slabs = pool->slabs;
+        pool->slabs.clear();
+        for (auto slab : slabs) {
+            deleteSlab(slab);
+        }
+
+        unrefPool(pool);
+    }
+
+    SlabPool* pool = new SlabPool;
+};
+
+thread_local PoolHolder localPool;
+
+ChunkSlab* acquire(size_t length)
+{
+    const auto pool = localPool.pool;
+    if (pool->slabs.isEmpty()) {
+        for (auto slab = pool->returned.exchange(nullptr, std::memory_order_acquire); slab;) {
+            const auto next = slab->next;
+            pool->slabs.append(slab);
+            slab = next;
+        }
+    }
+
+    ChunkSlab* slab = nullptr;
+    if (length > ChunkBuffer::SlabSize) {
+        slab = newSlab(length, nullptr);
+    } else if (!pool->slabs.isEmpty()) {
+        ++reuses;
+        slab = pool->slabs.takeLast();
+    } else {
+        slab = newSlab(ChunkBuffer::SlabSize, pool);
+    }
+
+    slab->ref.store(1, std::memory_order_relaxed);
+    slab->size = length;
+    return slab;
+}
+
+void release(ChunkSlab* slab)
+{
+    if (!slab || slab->ref.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    const auto pool = slab->pool;
+    if (!pool) {
+        deleteSlab(slab);
+    } else if (pool == localPool.pool) {
+        if (pool->slabs.size() < MaxFreeSlabs) {
+            pool->slabs.append(slab);
+        } else {
+            deleteSlab(slab);
+        }
+    } else {
+        // once pushed, the slab and with it the pool may be freed by others
+        pool->refs.fetch_add(1, std::memory_order_relaxed);
+        auto head = pool->returned.load(std::memory_order_relaxed);
+        do {
+            slab->next = head;
+        } while (!pool->returned.compare_exchange_weak(head, slab));
+
+        // the owner may have exited before the push, then nobody drains the stack
+        if (pool->orphaned.load()) {
+            deleteSlabs(pool->returned.exchange(nullptr));
+        }
+
+        unrefPool(pool);
+    }
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class ChunkBuffer
+ * @brief Reference counted buffer for file chunks, backed by a slab pool.
+ *
+ * Buffers of up to SlabSize bytes are taken from a per-thread pool of
+ * fixed-size slabs and returned to that pool once the last copy is
+ * destroyed, on whichever thread that happens, so steady state transfers
+ * don't hit the allocator for every chunk. Copies
+ * share the slab, which makes passing a buffer through queued signal
+ * connections as cheap as passing a pointer.
+ */
+
+/**
+ * @brief Creates a null buffer.
+ */
+ChunkBuffer::ChunkBuffer()
+    : slab{nullptr}
+{
+}
+
+ChunkBuffer::ChunkBuffer(ChunkSlab* slab)
+    : slab{slab}
+{
+}
+
+ChunkBuffer::ChunkBuffer(const ChunkBuffer& other)
+    : slab{other.slab}
+{
+    if (slab) {
+        slab->ref.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+ChunkBuffer::ChunkBuffer(ChunkBuffer&& other)
+    : slab{other.slab}
+{
+    other.slab = nullptr;
+}
+
+ChunkBuffer& ChunkBuffer::operator=(const ChunkBuffer& other)
+{
+    if (other.slab) {
+        other.slab->ref.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    release(slab);
+    slab = other.slab;
+    return *this;
+}
+
+ChunkBuffer& ChunkBuffer::operator=(ChunkBuffer&& other)
+{
+    if (this != &other) {
+        release(slab);
+        slab = other.slab;
+        other.slab = nullptr;
+    }
+
+    return *this;
+}
+
+ChunkBuffer::~ChunkBuffer()
+{
+    release(slab);
+}
+
+/**
+ * @brief Gets an uninitialized buffer from the pool of the calling thread.
+ * @param length Size of the buffer, larger than SlabSize is not pooled.
+ */
+ChunkBuffer ChunkBuffer::allocate(size_t length)
+{
+    return ChunkBuffer{acquire(length)};
+}
+
+/**
+ * @brief Gets a buffer from the pool and fills it with a copy of data.
+ */
+ChunkBuffer ChunkBuffer::copy(const uint8_t* data, size_t length)
+{
+    auto buffer = allocate(length);
+    memcpy(buffer.data(), data, length);
+    return buffer;
+}
+
+/**
+ * @brief Counts slabs taken from the allocator and from the free lists.
+ */
+ChunkBuffer::PoolStats ChunkBuffer::getPoolStats()
+{
+    return PoolStats{allocations.load(), reuses.load()};
+}
+
+bool ChunkBuffer::isNull() const
+{
+    return !slab;
+}
+
+const uint8_t* ChunkBuffer::data() const
+{
+    return slab ? slab->bytes() : nullptr;
+}
+
+/**
+ * @brief Gets the writable data, only valid while the buffer isn't shared.
+ */
+uint8_t* ChunkBuffer::data()
+{
+    return slab ? slab->bytes() : nullptr;
+}
+
+size_t ChunkBuffer::size() const
+{
+    return slab ? slab->size : 0;
+}
+
+/**
+ * @brief Copies the contents into a QByteArray.
+ */
+QByteArray ChunkBuffer::toByteArray() const
+{
+    if (!slab) {
+        return {};
+    }
+
+    return QByteArray(reinterpret_cast<const char*>(slab->bytes()), static_cast<int>(slab->size));
+}
+
+}
@@ -3,6 +3,8 @@
 #include "toxstring.h"
 #include "datahelper.h"
 #include "fillerror.h"
+#include "messagededup.h"
+#include "services.h"
 
 #include <QMap>
 
@@ -101,6 +103,24 @@ void fillErrGetType(ToxErr toxErr, Err* err)
 #undef ERR
 }
 
+void onConferenceMessage(struct Tox*, uint32_t conferenceNum, uint32_t peerNum,
+        TOX_MESSAGE_TYPE toxType, const uint8_t* cMessage, size_t length,
+        void* payload)
+{
+    auto services = static_cast<QtTox::Services*>(payload);
+    if (services->conference->isDuplicateMessage(conferenceNum, peerNum, cMessage, length)) {
+        return;
+    }
+
+    const auto map = QMap<TOX_MESSAGE_TYPE, QtTox::MessageType> {
+        { TOX_MESSAGE_TYPE_NORMAL, QtTox::MessageType::Normal },
+        { TOX_MESSAGE_TYPE_ACTION, QtTox::MessageType::Action },
+    };
+    const auto type = map[toxType];
+    const auto message = ToxString(cMessage, length).getQString();
+    emit services->conference->messageReceived(conferenceNum, peerNum, type, message);
+}
+
 }
 
 namespace QtTox
@@ -109,8 +129,11 @@ namespace QtTox
 Conference::Conference(struct Tox* tox)
     : tox{tox}
 {
+    tox_callback_conference_message(tox, onConferenceMessage);
 }
 
+Conference::~Conference() = default;
+
 uint32_t Conference::getPeerCount(uint32_t conferenceNum,
         ErrPeerQuery* err) const
 {
@@ -191,6 +214,12 @@ uint32_t Conference::join(uint32_t friendNum, const QByteArray& cookie,
 
 bool Conference::sendMessage(uint32_t conferenceNum,
         MessageType type, const QString& message, ErrSendMessage* err)
+{
+    return sendMessage(conferenceNum, type, ToxString(message), err);
+}
+
+bool Conference::sendMessage(uint32_t conferenceNum,
+        MessageType type, const ToxString& toxMessage, ErrSendMessage* err)
 {
     TOX_ERR_CONFERENCE_SEND_MESSAGE toxErr;
     const auto map = QMap<MessageType, TOX_MESSAGE_TYPE> {
@@ -198,10 +227,27 @@ bool Conference::sendMessage(uint32_t conferenceNum,
         { MessageType::Action, TOX_MESSAGE_TYPE_ACTION },
     };
     const auto toxType = map[type];
-    const auto toxMessage = ToxString(message);
+    // outgoing messages are keyed by conference, so one text may still
+    // be bridged into many conferences but not repeated into the same one
+    const auto key = static_cast<const void*>(&conferenceNum);
+    const auto fingerprint = dedup ? MessageDedup::fingerprint(static_cast<const uint8_t*>(key),
+            sizeof(conferenceNum), toxMessage.data(), toxMessage.size()) : 0;
+    if (dedup && dedup->wasSeen(fingerprint)) {
+        if (err) {
+            *err = ErrSendMessage::Duplicate;
+        }
+
+        return false;
+    }
+
     const auto success = tox_conference_send_message(tox, conferenceNum,
             toxType, toxMessage.data(), toxMessage.size(), &toxErr);
     fillErrSendMessage(toxErr, err);
+    // a failed send may be retried, so only sent messages count as seen
+    if (success && dedup) {
+        dedup->record(fingerprint);
+    }
+
     return success;
 }
 
@@ -238,4 +284,34 @@ bool Conference::setTitle(uint32_t conferenceNum, const QString& title,
     return success;
 }
 
+void Conference::setDedupWindow(uint32_t windowMs, int capacity)
+{
+    if (windowMs == 0) {
+        dedup.reset();
+        return;
+    }
+
+    dedup.reset(new MessageDedup(windowMs, capacity));
+}
+
+uint64_t Conference::getSuppressedCount() const
+{
+    return dedup ? dedup->getSuppressedCount() : 0;
+}
+
+bool Conference::isDuplicateMessage(uint32_t conferenceNum, uint32_t peerNum,
+        const uint8_t* message, size_t length)
+{
+    if (!dedup) {
+        return false;
+    }
+
+    uint8_t pk[TOX_PUBLIC_KEY_SIZE];
+    if (!tox_conference_peer_get_public_key(tox, conferenceNum, peerNum, pk, nullptr)) {
+        return false;
+    }
+
+    return dedup->isDuplicate(pk, sizeof(pk), message, length);
+}
+
 }
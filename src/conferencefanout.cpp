@@ -0,0 +1,153 @@
+#include "conferencefanout.h"
+
+namespace
+{
+
+bool isRetryable(QtTox::Conference::ErrSendMessage err)
+{
+    return err == QtTox::Conference::ErrSendMessage::NoConnection
+        || err == QtTox::Conference::ErrSendMessage::FailSend;
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class ConferenceFanout
+ * @brief Sends one message to many conferences and retries failed sends.
+ *
+ * The message is encoded once per post() and shared by all per-conference
+ * queues. Conferences that fail with a transient error keep the message
+ * queued and are retried on each iterate() until they succeed or run out of
+ * attempts. Messages to one conference are always sent in posting order.
+ * Conferences have no receipts, so a successful send is the final outcome.
+ */
+
+/**
+ * @param conference Conference service used for sending.
+ * @param maxAttempts Number of send attempts before a message is dropped.
+ */
+ConferenceFanout::ConferenceFanout(Conference* conference, int maxAttempts)
+    : conference{conference}
+    , maxAttempts{maxAttempts}
+{
+}
+
+/**
+ * @brief Sends a message to the given conferences.
+ * @return Identifier reported in sendResult() and postFinished().
+ *
+ * Conferences without queued messages are sent to immediately, results for
+ * them are reported before this function returns.
+ */
+uint64_t ConferenceFanout::post(const QVector<uint32_t>& conferenceNums,
+        MessageType type, const QString& message)
+{
+    const auto postId = nextPostId++;
+    const auto toxMessage = ToxString{message};
+    progress.insert(postId, Progress{conferenceNums.size(), 0, 0});
+
+    auto results = QVector<Result>{};
+    for (const auto conferenceNum : conferenceNums) {
+        auto pending = Pending{postId, type, toxMessage, 0};
+        auto& queue = queues[conferenceNum];
+        if (!queue.isEmpty() || !trySend(conferenceNum, pending, results)) {
+            queue.enqueue(pending);
+        }
+
+        if (queue.isEmpty()) {
+            queues.remove(conferenceNum);
+        }
+    }
+
+    if (conferenceNums.isEmpty()) {
+        progress.remove(postId);
+        emit postFinished(postId, 0, 0);
+    }
+
+    report(results);
+    return postId;
+}
+
+/**
+ * @brief Retries queued messages, call after each Core::iterate().
+ */
+void ConferenceFanout::iterate()
+{
+    auto results = QVector<Result>{};
+    auto it = queues.begin();
+    while (it != queues.end()) {
+        auto& queue = it.value();
+        while (!queue.isEmpty() && trySend(it.key(), queue.head(), results)) {
+            queue.dequeue();
+        }
+
+        if (queue.isEmpty()) {
+            it = queues.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    report(results);
+}
+
+/**
+ * @brief Number of messages waiting for a retry over all conferences.
+ */
+int ConferenceFanout::getPendingCount() const
+{
+    auto count = 0;
+    for (const auto& queue : queues) {
+        count += queue.size();
+    }
+
+    return count;
+}
+
+/**
+ * @brief Attempts to send a pending message.
+ * @return True if the message is done with, false if it should be retried.
+ */
+bool ConferenceFanout::trySend(uint32_t conferenceNum, Pending& pending,
+        QVector<Result>& results)
+{
+    auto err = Conference::ErrSendMessage::Ok;
+    conference->sendMessage(conferenceNum, pending.type, pending.message, &err);
+    ++pending.attempts;
+    if (isRetryable(err) && pending.attempts < maxAttempts) {
+        return false;
+    }
+
+    results.append(Result{pending.postId, conferenceNum, err});
+    return true;
+}
+
+void ConferenceFanout::report(const QVector<Result>& results)
+{
+    // emit only after the queues are consistent, receivers may post again
+    for (const auto& result : results) {
+        emit sendResult(result.postId, result.conferenceNum, result.err);
+
+        auto it = progress.find(result.postId);
+        if (it == progress.end()) {
+            continue;
+        }
+
+        if (result.err == Conference::ErrSendMessage::Ok) {
+            ++it->sent;
+        } else {
+            ++it->failed;
+        }
+
+        if (--it->remaining == 0) {
+            const auto done = *it;
+            progress.erase(it);
+            emit postFinished(result.postId, done.sent, done.failed);
+        }
+    }
+}
+
+}
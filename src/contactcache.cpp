@@ -0,0 +1,246 @@
+#include "contactcache.h"
+
+#include "datahelper.h"
+#include "messenger.h"
+#include "startupreport.h"
+#include "toxstring.h"
+
+#include <algorithm>
+
+#include <tox/tox.h>
+
+namespace
+{
+
+// switches instead of the usual lookup maps, these run once per friend in build()
+QtTox::UserStatus toUserStatus(TOX_USER_STATUS toxStatus)
+{
+    switch (toxStatus) {
+    case TOX_USER_STATUS_AWAY:
+        return QtTox::UserStatus::Away;
+    case TOX_USER_STATUS_BUSY:
+        return QtTox::UserStatus::Busy;
+    default:
+        return QtTox::UserStatus::None;
+    }
+}
+
+QtTox::Connection toConnection(TOX_CONNECTION toxStatus)
+{
+    switch (toxStatus) {
+    case TOX_CONNECTION_TCP:
+        return QtTox::Connection::TCP;
+    case TOX_CONNECTION_UDP:
+        return QtTox::Connection::UDP;
+    default:
+        return QtTox::Connection::None;
+    }
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class ContactCache
+ * @brief Snapshot of the friend and conference lists with their details.
+ *
+ * build() reads every friend and conference once in a tight loop, reusing a
+ * single buffer for names and status messages, so the application does not
+ * have to issue one query per field per friend at startup. The cache is kept
+ * current from the Messenger signals after attach(), friends added or
+ * removed later have to be passed to refreshFriend() or removeFriend().
+ */
+
+ContactCache::ContactCache(struct Tox* tox)
+    : tox{tox}
+{
+}
+
+/**
+ * @brief Reads all friends and conferences from the Tox instance.
+ * @param report Receives the timings of the friend and conference phases,
+ * may be nullptr.
+ */
+void ContactCache::build(StartupReport* report)
+{
+    auto start = report ? report->now() : 0;
+    const auto friendCount = tox_self_get_friend_list_size(tox);
+    auto numbers = QVector<uint32_t>(static_cast<int>(friendCount));
+    tox_self_get_friend_list(tox, numbers.data());
+
+    auto size = 0;
+    for (const auto friendNum : numbers) {
+        size = std::max(size, static_cast<int>(friendNum) + 1);
+    }
+
+    friends.clear();
+    friends.resize(size);
+    present.fill(false, size);
+    reserve(std::max(tox_max_name_length(), tox_max_status_message_length()));
+    for (const auto friendNum : numbers) {
+        auto& info = friends[static_cast<int>(friendNum)];
+        info.friendNum = friendNum;
+        present[static_cast<int>(friendNum)] = fill(info);
+    }
+
+    if (report) {
+        report->record(QStringLiteral("cache friends"), start);
+        start = report->now();
+    }
+
+    const auto conferenceCount = tox_conference_get_chatlist_size(tox);
+    numbers.resize(static_cast<int>(conferenceCount));
+    tox_conference_get_chatlist(tox, numbers.data());
+    conferences.clear();
+    conferences.reserve(numbers.size());
+    for (const auto conferenceNum : numbers) {
+        Tox_Err_Conference_Title toxErr;
+        const auto length = tox_conference_get_title_size(tox, conferenceNum, &toxErr);
+        auto title = QString{};
+        if (toxErr == TOX_ERR_CONFERENCE_TITLE_OK && length > 0) {
+            auto bytes = reserve(length);
+            if (tox_conference_get_title(tox, conferenceNum, bytes, nullptr)) {
+                title = ToxString(bytes, length).getQString();
+            }
+        }
+
+        conferences.append({conferenceNum, title});
+    }
+
+    if (report) {
+        report->record(QStringLiteral("cache conferences"), start);
+    }
+}
+
+/**
+ * @brief Keeps the cached friend details current from the messenger signals.
+ */
+void ContactCache::attach(Messenger* messenger)
+{
+    connect(messenger, &Messenger::friendNameChanged, this,
+            [this](uint32_t friendNum, const QString& name) {
+        if (friendNum < static_cast<uint32_t>(present.size()) && present[friendNum]) {
+            friends[friendNum].name = name;
+        }
+    });
+    connect(messenger, &Messenger::friendStatusMessageChanged, this,
+            [this](uint32_t friendNum, const QString& message) {
+        if (friendNum < static_cast<uint32_t>(present.size()) && present[friendNum]) {
+            friends[friendNum].statusMessage = message;
+        }
+    });
+    connect(messenger, &Messenger::friendStatusChanged, this,
+            [this](uint32_t friendNum, UserStatus status) {
+        if (friendNum < static_cast<uint32_t>(present.size()) && present[friendNum]) {
+            friends[friendNum].status = status;
+        }
+    });
+    connect(messenger, &Messenger::friendConnectionStatusChanged, this,
+            [this](uint32_t friendNum, Connection status) {
+        if (friendNum < static_cast<uint32_t>(present.size()) && present[friendNum]) {
+            friends[friendNum].connection = status;
+        }
+    });
+}
+
+/**
+ * @brief Reads the details of one friend again, e.g. after it was added.
+ */
+void ContactCache::refreshFriend(uint32_t friendNum)
+{
+    const auto index = static_cast<int>(friendNum);
+    if (index >= friends.size()) {
+        friends.resize(index + 1);
+        present.resize(index + 1);
+    }
+
+    friends[index].friendNum = friendNum;
+    present[index] = fill(friends[index]);
+}
+
+void ContactCache::removeFriend(uint32_t friendNum)
+{
+    const auto index = static_cast<int>(friendNum);
+    if (index < present.size()) {
+        present[index] = false;
+        friends[index] = Friend{};
+    }
+}
+
+/**
+ * @return Cached details of the friend or nullptr if it is not cached. The
+ * pointer is invalidated by build() and refreshFriend().
+ */
+const ContactCache::Friend* ContactCache::getFriend(uint32_t friendNum) const
+{
+    const auto index = static_cast<int>(friendNum);
+    if (index >= present.size() || !present[index]) {
+        return nullptr;
+    }
+
+    return &friends[index];
+}
+
+QVector<ContactCache::Friend> ContactCache::getFriends() const
+{
+    auto result = QVector<Friend>{};
+    result.reserve(friends.size());
+    for (auto i = 0; i < friends.size(); ++i) {
+        if (present[i]) {
+            result.append(friends[i]);
+        }
+    }
+
+    return result;
+}
+
+QVector<ContactCache::Conference> ContactCache::getConferences() const
+{
+    return conferences;
+}
+
+bool ContactCache::fill(Friend& info)
+{
+    const auto friendNum = info.friendNum;
+    info.publicKey.resize(TOX_PUBLIC_KEY_SIZE);
+    if (!tox_friend_get_public_key(tox, friendNum, data(info.publicKey), nullptr)) {
+        return false;
+    }
+
+    Tox_Err_Friend_Query toxErr;
+    auto length = tox_friend_get_name_size(tox, friendNum, &toxErr);
+    if (toxErr == TOX_ERR_FRIEND_QUERY_OK && length > 0) {
+        auto bytes = reserve(length);
+        tox_friend_get_name(tox, friendNum, bytes, nullptr);
+        info.name = ToxString(bytes, length).getQString();
+    } else {
+        info.name.clear();
+    }
+
+    length = tox_friend_get_status_message_size(tox, friendNum, &toxErr);
+    if (toxErr == TOX_ERR_FRIEND_QUERY_OK && length > 0) {
+        auto bytes = reserve(length);
+        tox_friend_get_status_message(tox, friendNum, bytes, nullptr);
+        info.statusMessage = ToxString(bytes, length).getQString();
+    } else {
+        info.statusMessage.clear();
+    }
+
+    info.status = toUserStatus(tox_friend_get_status(tox, friendNum, nullptr));
+    info.connection = toConnection(tox_friend_get_connection_status(tox, friendNum, nullptr));
+    info.lastOnline = tox_friend_get_last_online(tox, friendNum, nullptr);
+    return true;
+}
+
+uint8_t* ContactCache::reserve(size_t size)
+{
+    if (static_cast<size_t>(buffer.size()) < size) {
+        buffer.resize(static_cast<int>(size));
+    }
+
+    return data(buffer);
+}
+
+}
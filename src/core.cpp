@@ -0,0 +1,299 @@
+#include "core.h"
+
+#include "chatlist.h"
+#include "conference.h"
+#include "datahelper.h"
+#include "files.h"
+#include "fillerror.h"
+#include "lowlevel.h"
+#include "messenger.h"
+#include "self.h"
+#include "services.h"
+#include "startupreport.h"
+#include "toxstring.h"
+
+#include <QMap>
+
+#include <tox/tox.h>
+
+namespace
+{
+
+template<class ToxErr, class Err>
+void fillErrNew(ToxErr toxErr, Err* err)
+{
+#define ERR(toxName, qtName) \
+    { TOX_ERR_NEW_##toxName, Err::qtName }
+    fillError(toxErr, err, {
+        ERR(OK,                Ok),
+        ERR(NULL,              Null),
+        ERR(MALLOC,            Malloc),
+        ERR(PORT_ALLOC,        PortAlloc),
+        ERR(PROXY_BAD_TYPE,    ProxyBadType),
+        ERR(PROXY_BAD_HOST,    ProxyBadHost),
+        ERR(PROXY_BAD_PORT,    PorxyBadPort),
+        ERR(PROXY_NOT_FOUND,   ProxyNotFound),
+        ERR(LOAD_ENCRYPTED,    LoadEncrypted),
+        ERR(LOAD_BAD_FORMAT,   LoadBadFormat),
+    });
+#undef ERR
+}
+
+template<class ToxErr, class Err>
+void fillErrBootstrap(ToxErr toxErr, Err* err)
+{
+#define ERR(toxName, qtName) \
+    { TOX_ERR_BOOTSTRAP_##toxName, Err::qtName }
+    fillError(toxErr, err, {
+        ERR(OK,       Ok),
+        ERR(NULL,     Null),
+        ERR(BAD_HOST, BadHost),
+        ERR(BAD_PORT, BadPort),
+    });
+#undef ERR
+}
+
+void onLog(struct Tox*, TOX_LOG_LEVEL toxLevel, const char* file, uint32_t line,
+        const char* func, const char* message, void* userData)
+{
+    auto core = static_cast<QtTox::Core*>(userData);
+    const auto map = QMap<TOX_LOG_LEVEL, QtTox::Options::ToxLogLevel> {
+        { TOX_LOG_LEVEL_TRACE,   QtTox::Options::ToxLogLevel::Trace },
+        { TOX_LOG_LEVEL_DEBUG,   QtTox::Options::ToxLogLevel::Debug },
+        { TOX_LOG_LEVEL_INFO,    QtTox::Options::ToxLogLevel::Info },
+        { TOX_LOG_LEVEL_WARNING, QtTox::Options::ToxLogLevel::Warning },
+        { TOX_LOG_LEVEL_ERROR,   QtTox::Options::ToxLogLevel::Error },
+    };
+    emit core->Log(map[toxLevel], QString::fromUtf8(file), line,
+            QString::fromUtf8(func), QString::fromUtf8(message));
+}
+
+void toToxOptions(const QtTox::Options& options, struct Tox_Options* toxOptions,
+        const QByteArray& proxyHost, const QByteArray& savedata)
+{
+    const auto proxyMap = QMap<QtTox::Options::ToxProxyType, TOX_PROXY_TYPE> {
+        { QtTox::Options::ToxProxyType::None,   TOX_PROXY_TYPE_NONE },
+        { QtTox::Options::ToxProxyType::Http,   TOX_PROXY_TYPE_HTTP },
+        { QtTox::Options::ToxProxyType::Socks5, TOX_PROXY_TYPE_SOCKS5 },
+    };
+    const auto savedataMap = QMap<QtTox::Options::ToxSaveDataType, TOX_SAVEDATA_TYPE> {
+        { QtTox::Options::ToxSaveDataType::None,      TOX_SAVEDATA_TYPE_NONE },
+        { QtTox::Options::ToxSaveDataType::ToxSave,   TOX_SAVEDATA_TYPE_TOX_SAVE },
+        { QtTox::Options::ToxSaveDataType::SecretKey, TOX_SAVEDATA_TYPE_SECRET_KEY },
+    };
+
+    tox_options_set_ipv6_enabled(toxOptions, options.getIpv6Enabled());
+    tox_options_set_udp_enabled(toxOptions, options.getUdpEnabled());
+    tox_options_set_local_discovery_enabled(toxOptions, options.getLocalDiscoveryEnabled());
+    tox_options_set_proxy_type(toxOptions, proxyMap[options.getProxyType()]);
+    tox_options_set_proxy_host(toxOptions, proxyHost.constData());
+    tox_options_set_proxy_port(toxOptions, options.getProxyPort());
+    tox_options_set_start_port(toxOptions, options.getStartPort());
+    tox_options_set_end_port(toxOptions, options.getEndPort());
+    tox_options_set_tcp_port(toxOptions, options.getTcpPort());
+    tox_options_set_savedata_type(toxOptions, savedataMap[options.getSavedataType()]);
+    tox_options_set_savedata_data(toxOptions, data(savedata), size(savedata));
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class Core
+ * @brief Owns the Tox instance and the services built on it.
+ *
+ * Every step of the construction is recorded as a phase of the startup
+ * report, followed by the bootstrap calls and the time until the instance
+ * first comes online. startupFinished() is emitted at that point, the report
+ * is complete from then on.
+ */
+
+/**
+ * @param report Report to record the startup phases into, Core keeps its
+ * own if it is nullptr. It has to outlive the Core.
+ */
+Core::Core(const Options& options, ErrNew* error, StartupReport* report)
+    : services{new Services{}}
+{
+    if (!report) {
+        ownReport.reset(new StartupReport{});
+        report = ownReport.get();
+    }
+
+    this->report = report;
+
+    auto start = report->now();
+    struct Tox_Options* toxOptions = tox_options_new(nullptr);
+    // both have to stay alive until tox_new returns
+    const auto proxyHost = options.getProxyHost().toUtf8();
+    const auto savedata = options.getSavedata();
+    toToxOptions(options, toxOptions, proxyHost, savedata);
+    tox_options_set_log_callback(toxOptions, onLog);
+    tox_options_set_log_user_data(toxOptions, this);
+    report->record(QStringLiteral("options"), start);
+
+    start = report->now();
+    Tox_Err_New toxErr;
+    tox = tox_new(toxOptions, &toxErr);
+    tox_options_free(toxOptions);
+    fillErrNew(toxErr, error);
+    report->record(QStringLiteral("tox_new"), start);
+    if (!tox) {
+        return;
+    }
+
+    start = report->now();
+    messenger = new Messenger{tox};
+    report->record(QStringLiteral("Messenger"), start);
+
+    start = report->now();
+    chatList = new ChatList{tox};
+    report->record(QStringLiteral("ChatList"), start);
+
+    start = report->now();
+    conference = new Conference{tox};
+    report->record(QStringLiteral("Conference"), start);
+
+    start = report->now();
+    files = new Files{tox};
+    report->record(QStringLiteral("Files"), start);
+
+    start = report->now();
+    lowLevel = new LowLevel{tox};
+    report->record(QStringLiteral("LowLevel"), start);
+
+    start = report->now();
+    self = new Self{tox};
+    report->record(QStringLiteral("Self"), start);
+
+    *services = Services{messenger, chatList, conference, files, lowLevel, self};
+    connect(self, &Self::selfConnectionStatusChanged, this, [this](Connection status) {
+        if (status != Connection::None) {
+            finishStartup();
+        }
+    });
+    constructedAt = report->now();
+}
+
+Core::~Core()
+{
+    delete self;
+    delete lowLevel;
+    delete files;
+    delete conference;
+    delete chatList;
+    delete messenger;
+    if (tox) {
+        tox_kill(tox);
+    }
+}
+
+QByteArray Core::getSavedata()
+{
+    auto savedata = QByteArray{};
+    savedata.resize(static_cast<int>(tox_get_savedata_size(tox)));
+    tox_get_savedata(tox, data(savedata));
+    return savedata;
+}
+
+bool Core::bootstrap(const QString& address, uint16_t port,
+        const QByteArray& publicKey, ErrBootstrap* err)
+{
+    const auto start = report->now();
+    if (bootstrapStart < 0) {
+        bootstrapStart = start;
+    }
+
+    const auto host = address.toUtf8();
+    Tox_Err_Bootstrap toxErr;
+    const auto success = tox_bootstrap(tox, host.constData(), port, data(publicKey), &toxErr);
+    fillErrBootstrap(toxErr, err);
+    // later calls, e.g. from BootstrapManager or RelayPool, aren't startup
+    if (!online) {
+        report->record(QStringLiteral("bootstrap %1:%2").arg(address).arg(port), start);
+    }
+
+    return success;
+}
+
+bool Core::addTcpReleay(const QString& address, uint16_t port,
+        const QByteArray& publicKey, ErrBootstrap* err)
+{
+    const auto start = report->now();
+    if (bootstrapStart < 0) {
+        bootstrapStart = start;
+    }
+
+    const auto host = address.toUtf8();
+    Tox_Err_Bootstrap toxErr;
+    const auto success = tox_add_tcp_relay(tox, host.constData(), port, data(publicKey), &toxErr);
+    fillErrBootstrap(toxErr, err);
+    // later calls, e.g. from BootstrapManager or RelayPool, aren't startup
+    if (!online) {
+        report->record(QStringLiteral("tcp relay %1:%2").arg(address).arg(port), start);
+    }
+
+    return success;
+}
+
+uint32_t Core::iterationInterval() const
+{
+    return tox_iteration_interval(tox);
+}
+
+void Core::iterate()
+{
+    tox_iterate(tox, services.get());
+}
+
+const StartupReport& Core::getStartupReport() const
+{
+    return *report;
+}
+
+ChatList* Core::getChatList() const
+{
+    return chatList;
+}
+
+Conference* Core::getConference() const
+{
+    return conference;
+}
+
+Files* Core::getFiles() const
+{
+    return files;
+}
+
+LowLevel* Core::getLowLevel() const
+{
+    return lowLevel;
+}
+
+Messenger* Core::getMessenger() const
+{
+    return messenger;
+}
+
+Self* Core::getSelf() const
+{
+    return self;
+}
+
+void Core::finishStartup()
+{
+    if (online) {
+        return;
+    }
+
+    // without a bootstrap call the instance came online from the saved nodes
+    const auto start = bootstrapStart >= 0 ? bootstrapStart : constructedAt;
+    report->record(QStringLiteral("until online"), start);
+    online = true;
+    emit startupFinished();
+}
+
+}
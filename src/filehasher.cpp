@@ -0,0 +1,77 @@
+#include "filehasher.h"
+
+#include "files.h"
+
+#include <QRunnable>
+
+namespace
+{
+
+class HashJob : public QRunnable
+{
+public:
+    HashJob(QtTox::FileHasher* hasher, const QString& path)
+        : hasher{hasher}
+        , path{path}
+    {
+    }
+
+    void run() override
+    {
+        const auto fileId = QtTox::hashFile(path);
+        emit hasher->fileHashed(path, fileId);
+    }
+
+private:
+    QtTox::FileHasher* hasher;
+    QString path;
+};
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class FileHasher
+ * @brief Computes file IDs of many files concurrently.
+ *
+ * Every file is hashed with hashFile() on a pool of worker threads, so
+ * large files are streamed instead of loaded into memory and separate
+ * files are hashed on separate cores.
+ */
+
+/**
+ * @param maxThreads Maximum number of files hashed at the same time.
+ */
+FileHasher::FileHasher(int maxThreads)
+{
+    pool.setMaxThreadCount(maxThreads);
+}
+
+/**
+ * @brief Drops files that are not being hashed yet and waits for the rest.
+ */
+FileHasher::~FileHasher()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+/**
+ * @brief Queues a file for hashing, the result is reported by fileHashed().
+ */
+void FileHasher::hashFile(const QString& path)
+{
+    pool.start(new HashJob{this, path});
+}
+
+/**
+ * @brief Blocks until all queued files are hashed.
+ */
+void FileHasher::waitForDone()
+{
+    pool.waitForDone();
+}
+
+}
@@ -0,0 +1,26 @@
+#ifndef _QT_TOX_FILE_PREFETCH_H_
+#define _QT_TOX_FILE_PREFETCH_H_
+
+#include <QFile>
+
+#include <cstdint>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
+// Asks the kernel to read a range of the file into the page cache in the
+// background, it's a no-op where posix_fadvise is not available
+inline void prefetch(QFile& file, uint64_t offset, uint64_t length)
+{
+#ifdef Q_OS_LINUX
+    posix_fadvise(file.handle(), static_cast<off_t>(offset), static_cast<off_t>(length),
+                  POSIX_FADV_WILLNEED);
+#else
+    Q_UNUSED(file);
+    Q_UNUSED(offset);
+    Q_UNUSED(length);
+#endif
+}
+
+#endif // _QT_TOX_FILE_PREFETCH_H_
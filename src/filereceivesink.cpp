@@ -0,0 +1,225 @@
+#include "filereceivesink.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#endif
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace
+{
+
+bool preallocate(QFile& file, uint64_t size)
+{
+#ifdef Q_OS_LINUX
+    // reserve the blocks up front, a full disk must fail here and not as
+    // SIGBUS on a write through the mapping later on
+    const auto error = posix_fallocate(file.handle(), 0, static_cast<off_t>(size));
+    if (error != 0) {
+        qWarning() << "Can't preallocate" << file.fileName() << strerror(error);
+        return false;
+    }
+
+    return true;
+#else
+    // a sparse file, a full disk shows up as SIGBUS on a write to the mapping
+    return file.resize(static_cast<qint64>(size));
+#endif
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class FileReceiveSink
+ * @brief Writes incoming file chunks straight into a memory mapped file.
+ *
+ * The destination is preallocated to the size announced for the transfer
+ * and every chunk is copied from the toxcore buffer to its position in the
+ * mapping, so no intermediate QByteArray is created per chunk.
+ */
+
+FileReceiveSink::~FileReceiveSink()
+{
+    for (auto& target : targets) {
+        release(target);
+    }
+}
+
+/**
+ * @brief Remembers the size of an incoming transfer until it is opened.
+ */
+void FileReceiveSink::announce(quint64 key, uint64_t fileSize)
+{
+    // toxcore drops transfers silently when a friend goes offline, so a
+    // reused file number can still have a stale target
+    close(key);
+    announced.insert(key, fileSize);
+}
+
+/**
+ * @brief Creates, preallocates and maps the destination file of a transfer.
+ * @param key Transfer key of an announced transfer.
+ * @param path Destination path.
+ * @param resume Keep the contents of an existing file instead of truncating it.
+ * @return True if chunks of the transfer are written to path from now on.
+ */
+bool FileReceiveSink::open(quint64 key, const QString& path, bool resume,
+        Files::ErrFileReceiveTo* err)
+{
+    const auto setErr = [err](Files::ErrFileReceiveTo value) {
+        if (err) {
+            *err = value;
+        }
+    };
+
+    if (!announced.contains(key) || targets.contains(key)) {
+        setErr(Files::ErrFileReceiveTo::NotFound);
+        return false;
+    }
+
+    const auto size = announced.value(key);
+    if (size > static_cast<uint64_t>(std::numeric_limits<qint64>::max())) {
+        // streaming transfers announce UINT64_MAX and cannot be preallocated
+        setErr(Files::ErrFileReceiveTo::UnknownSize);
+        return false;
+    }
+
+    auto file = new QFile{path};
+    const auto mode = resume ? QIODevice::ReadWrite : QIODevice::ReadWrite | QIODevice::Truncate;
+    if (!file->open(mode) || !preallocate(*file, size)) {
+        qWarning() << "Can't create" << path << file->errorString();
+        delete file;
+        setErr(Files::ErrFileReceiveTo::OpenFailed);
+        return false;
+    }
+
+    uchar* map = nullptr;
+    if (size > 0) {
+        map = file->map(0, static_cast<qint64>(size));
+        if (!map) {
+            qWarning() << "Can't map" << path << file->errorString();
+            delete file;
+            setErr(Files::ErrFileReceiveTo::MapFailed);
+            return false;
+        }
+    }
+
+    announced.remove(key);
+    targets.insert(key, Target{file, map, size});
+    setErr(Files::ErrFileReceiveTo::Ok);
+    return true;
+}
+
+/**
+ * @brief Writes a chunk of a transfer that was opened with open().
+ * @return False if the transfer is not handled by the sink.
+ *
+ * A chunk of length 0 marks the end of the transfer and closes the file.
+ */
+bool FileReceiveSink::write(quint64 key, uint64_t position, const uint8_t* data, size_t length)
+{
+    auto it = targets.find(key);
+    if (it == targets.end()) {
+        if (length == 0) {
+            announced.remove(key);
+        }
+
+        return false;
+    }
+
+    if (length == 0) {
+        release(*it);
+        targets.erase(it);
+        return true;
+    }
+
+    if (position > it->size || length > it->size - position) {
+        qWarning() << "Chunk beyond the announced file size dropped at" << position;
+        return true;
+    }
+
+    memcpy(it->map + position, data, length);
+    return true;
+}
+
+/**
+ * @brief Stops handling a transfer, e.g. after it was canceled.
+ */
+void FileReceiveSink::close(quint64 key)
+{
+    announced.remove(key);
+    auto it = targets.find(key);
+    if (it == targets.end()) {
+        return;
+    }
+
+    release(*it);
+    targets.erase(it);
+}
+
+/**
+ * @brief Writes the chunks of a transfer that are still in the mapping to disk.
+ * @return True if everything written so far is on disk.
+ */
+bool FileReceiveSink::sync(quint64 key)
+{
+    const auto it = targets.constFind(key);
+    if (it == targets.constEnd()) {
+        return false;
+    }
+
+    if (!it->map) {
+        return true;
+    }
+
+#ifdef Q_OS_WIN
+    const auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(it->file->handle()));
+    if (!FlushViewOfFile(it->map, static_cast<SIZE_T>(it->size)) || !FlushFileBuffers(handle)) {
+        qWarning() << "Can't sync" << it->file->fileName() << GetLastError();
+        return false;
+    }
+#else
+    if (msync(it->map, static_cast<size_t>(it->size), MS_SYNC) != 0) {
+        qWarning() << "Can't sync" << it->file->fileName() << strerror(errno);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+/**
+ * @brief Gets the size of an opened transfer.
+ */
+uint64_t FileReceiveSink::size(quint64 key) const
+{
+    return targets.value(key).size;
+}
+
+void FileReceiveSink::release(Target& target)
+{
+    if (target.map) {
+        target.file->unmap(target.map);
+    }
+
+    target.file->close();
+    delete target.file;
+    target.file = nullptr;
+}
+
+}
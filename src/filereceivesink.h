@@ -0,0 +1,49 @@
+#ifndef _QT_TOX_FILE_RECEIVE_SINK_H_
+#define _QT_TOX_FILE_RECEIVE_SINK_H_
+
+#include "files.h"
+
+#include <QHash>
+#include <QString>
+
+#include <cstddef>
+#include <cstdint>
+
+class QFile;
+
+namespace QtTox
+{
+
+class FileReceiveSink
+{
+public:
+    FileReceiveSink() = default;
+    FileReceiveSink(const FileReceiveSink& other) = delete;
+    FileReceiveSink& operator=(const FileReceiveSink& other) = delete;
+    ~FileReceiveSink();
+
+    void announce(quint64 key, uint64_t fileSize);
+    bool open(quint64 key, const QString& path, bool resume, Files::ErrFileReceiveTo* err);
+    bool write(quint64 key, uint64_t position, const uint8_t* data, size_t length);
+    void close(quint64 key);
+    bool sync(quint64 key);
+    uint64_t size(quint64 key) const;
+
+private:
+    struct Target
+    {
+        QFile* file;
+        uchar* map;
+        uint64_t size;
+    };
+
+    void release(Target& target);
+
+private:
+    QHash<quint64, uint64_t> announced;
+    QHash<quint64, Target> targets;
+};
+
+}
+
+#endif // _QT_TOX_FILE_RECEIVE_SINK_H_
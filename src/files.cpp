@@ -1,17 +1,33 @@
 #include "files.h"
 
+#include "avatarcache.h"
 #include "datahelper.h"
+#include "fileprefetch.h"
+#include "filereceivesink.h"
+#include "filesendsource.h"
 #include "fillerror.h"
+#include "sendqcontrol.h"
 #include "services.h"
 #include "toxstring.h"
+#include "transferjournal.h"
+#include "transferkey.h"
+#include "transfermonitor.h"
+#include "transferscheduler.h"
 
+#include <QCryptographicHash>
+#include <QFile>
 #include <QMap>
+#include <QMetaMethod>
+
+#include <algorithm>
 
 #include <tox/tox.h>
 
 namespace
 {
 
+const qint64 HashWindowSize = 8 * 1024 * 1024;
+
 const auto fileControlMap1 = QMap<TOX_FILE_CONTROL, QtTox::Files::FileControl> {
     {TOX_FILE_CONTROL::TOX_FILE_CONTROL_RESUME, QtTox::Files::FileControl::Resume},
     {TOX_FILE_CONTROL::TOX_FILE_CONTROL_PAUSE, QtTox::Files::FileControl::Pause},
@@ -125,11 +141,22 @@ void fillErrFileSendChunk(ToxErr toxErr, Err* err)
 #undef ERR
 }
 
+QByteArray friendPublicKey(Tox* tox, uint32_t friendNum)
+{
+    QByteArray pk{TOX_PUBLIC_KEY_SIZE, Qt::Initialization::Uninitialized};
+    if (!tox_friend_get_public_key(tox, friendNum, data(pk), nullptr)) {
+        return {};
+    }
+
+    return pk;
+}
+
 void onFileReceiveControl(Tox *tox, uint32_t friendNum, uint32_t fileNum, TOX_FILE_CONTROL control,
                           void *payload)
 {
     auto service = static_cast<QtTox::Services*>(payload);
     QtTox::Files::FileControl toxControl = fileControlMap1.value(control);
+    service->files->handleFileReceiveControl(friendNum, fileNum, toxControl);
     emit service->files->fileControlReceived(friendNum, fileNum, toxControl);
 }
 
@@ -137,6 +164,10 @@ void onFileChunkRequest(Tox* tox, uint32_t friendNum, uint32_t fileNum,
                         uint64_t position, size_t length, void* payload)
 {
     auto service = static_cast<QtTox::Services*>(payload);
+    if (service->files->handleFileChunkRequest(friendNum, fileNum, position, length)) {
+        return;
+    }
+
     emit service->files->fileChunkRequest(friendNum, fileNum, position, length);
 }
 
@@ -148,6 +179,10 @@ void onFileReceive(Tox *tox, uint32_t friendNum, uint32_t fileNum,
     // TODO(sudden6): remove the cast to TOX_FILE_KIND when the API definition is fixed
     QtTox::Files::FileKind toxKind = fileKindMap1.value(static_cast<TOX_FILE_KIND>(kind));
     ToxString toxFilename{filename, filename_length};
+    if (service->files->handleFileReceive(friendNum, fileNum, toxKind, file_size)) {
+        return;
+    }
+
     emit service->files->fileReceived(friendNum, fileNum, toxKind, file_size, toxFilename.getQString());
 }
 
@@ -156,8 +191,7 @@ void onFileReceiveChunk(Tox *tox, uint32_t friendNum, uint32_t fileNum,
                         void *payload)
 {
     auto service = static_cast<QtTox::Services*>(payload);
-    QByteArray chunk = bytes(data, length);
-    emit service->files->fileChunkReceived(friendNum, fileNum, position, chunk);
+    service->files->handleFileReceiveChunk(friendNum, fileNum, position, data, length);
 }
 }
 
@@ -174,8 +208,65 @@ QByteArray hash(const QByteArray &toHash)
     return hash;
 }
 
+/**
+ * @brief Computes the same hash as hash() over the contents of a file.
+ * @param path File to hash.
+ * @return Hash usable as file ID for Files::fileSend, empty on failure.
+ *
+ * The file is streamed through memory mapped windows and the next window
+ * is prefetched while the current one is hashed, so I/O overlaps with
+ * hashing and memory use doesn't depend on the file size. tox_hash() is
+ * SHA-256, which QCryptographicHash can compute incrementally.
+ */
+QByteArray hashFile(const QString& path)
+{
+    QFile file{path};
+    if (!file.open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    QCryptographicHash hasher{QCryptographicHash::Sha256};
+    const auto fileSize = file.size();
+    prefetch(file, 0, static_cast<uint64_t>(std::min(HashWindowSize, fileSize)));
+    for (qint64 offset = 0; offset < fileSize; offset += HashWindowSize) {
+        const auto length = std::min(HashWindowSize, fileSize - offset);
+        const auto next = offset + length;
+        if (next < fileSize) {
+            prefetch(file, static_cast<uint64_t>(next),
+                     static_cast<uint64_t>(std::min(HashWindowSize, fileSize - next)));
+        }
+
+        const auto window = file.map(offset, length);
+        if (window) {
+            hasher.addData(reinterpret_cast<const char*>(window), static_cast<int>(length));
+            file.unmap(window);
+            continue;
+        }
+
+        // not every file can be mapped, fall back to plain reads
+        if (!file.seek(offset)) {
+            return {};
+        }
+
+        const auto chunk = file.read(length);
+        if (chunk.size() != length) {
+            return {};
+        }
+
+        hasher.addData(chunk);
+    }
+
+    return hasher.result();
+}
+
 Files::Files(struct Tox* tox)
+    : receiveSink{new FileReceiveSink}
+    , sendSource{new FileSendSource}
+    , sendq{new SendqControl}
+    , scheduler{new TransferScheduler}
+    , monitor{new TransferMonitor}
 {
+    qRegisterMetaType<ChunkBuffer>("QtTox::ChunkBuffer");
     tox_callback_file_recv_control(tox, onFileReceiveControl);
     tox_callback_file_chunk_request(tox, onFileChunkRequest);
     tox_callback_file_recv(tox, onFileReceive);
@@ -183,12 +274,36 @@ Files::Files(struct Tox* tox)
     this->tox = tox;
 }
 
+Files::~Files()
+{
+    // the last marks need the sink, which is gone once members are destroyed
+    if (journal) {
+        journal->flush([this](quint64 key) { return receiveSink->sync(key); });
+    }
+}
+
 bool Files::fileControl(uint32_t friendNum, uint32_t fileNum, FileControl control, ErrFileControl *err)
+{
+    const auto success = controlTransfer(friendNum, fileNum, control, err);
+    // the scheduler must not resume what the user paused
+    if (success && control != FileControl::Cancel) {
+        scheduler->setUserPaused(transferKey(friendNum, fileNum), control == FileControl::Pause);
+    }
+
+    return success;
+}
+
+bool Files::controlTransfer(uint32_t friendNum, uint32_t fileNum, FileControl control,
+                            ErrFileControl *err)
 {
     TOX_FILE_CONTROL ctrl = fileControlMap2.value(control);
     TOX_ERR_FILE_CONTROL toxErr;
     bool success = tox_file_control(tox, friendNum, fileNum, ctrl, &toxErr);
     fillErrFileControl(toxErr, err);
+    if (success && control == FileControl::Cancel) {
+        closeTransfer(transferKey(friendNum, fileNum));
+    }
+
     return success;
 }
 
@@ -221,19 +336,462 @@ uint32_t Files::fileSend(uint32_t friendNum, FileKind kind, uint64_t file_size,
     TOX_ERR_FILE_SEND toxErr;
     TOX_FILE_KIND toxKind = fileKindMap2.value(kind);
     ToxString toxFilename{filename};
+    // without a file ID toxcore generates a random one
+    const uint8_t* id = fileId.isEmpty() ? nullptr : data(fileId);
     uint32_t fileNum = tox_file_send(tox, friendNum, toxKind, file_size,
-                                     data(fileId), toxFilename.data(),
+                                     id, toxFilename.data(),
                                      toxFilename.size(), &toxErr);
     fillErrFileSend(toxErr, err);
+    if (fileNum != UINT32_MAX) {
+        // toxcore drops transfers silently when the friend goes offline and
+        // reuses their numbers, so state of an earlier transfer may be left
+        const auto key = transferKey(friendNum, fileNum);
+        closeTransfer(key);
+        scheduler->setKind(key, kind);
+    }
+
+    return fileNum;
+}
+
+uint32_t Files::fileSendFromDisk(uint32_t friendNum, FileKind kind, const QString &path,
+                                 const QByteArray &fileId, const QString &filename,
+                                 Files::ErrFileSend *err)
+{
+    auto file = new QFile{path};
+    if (!file->open(QIODevice::ReadOnly)) {
+        delete file;
+        if (err) {
+            *err = ErrFileSend::OpenFailed;
+        }
+
+        return UINT32_MAX;
+    }
+
+    const auto fileSize = static_cast<uint64_t>(file->size());
+    const auto fileNum = fileSend(friendNum, kind, fileSize, fileId, filename, err);
+    if (fileNum == UINT32_MAX) {
+        delete file;
+        return fileNum;
+    }
+
+    sendSource->add(transferKey(friendNum, fileNum), file);
     return fileNum;
 }
 
-bool Files::fileSendChunk(uint32_t friendNum, uint32_t fileNum, uint32_t position, const QByteArray &fileData, Files::ErrFileSendChunk *err)
+bool Files::fileSendChunk(uint32_t friendNum, uint32_t fileNum, uint64_t position, const QByteArray &fileData, Files::ErrFileSendChunk *err)
+{
+    const auto chunk = SendqChunk{position, size(fileData), fileData, {}};
+    return sendOrDefer(friendNum, fileNum, chunk, data(fileData), err);
+}
+
+bool Files::fileSendChunk(uint32_t friendNum, uint32_t fileNum, uint64_t position, const ChunkBuffer &fileData, Files::ErrFileSendChunk *err)
+{
+    const auto chunk = SendqChunk{position, fileData.size(), {}, fileData};
+    return sendOrDefer(friendNum, fileNum, chunk, fileData.data(), err);
+}
+
+bool Files::sendChunk(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+                      const uint8_t *chunk, size_t length, Files::ErrFileSendChunk *err)
 {
     TOX_ERR_FILE_SEND_CHUNK toxErr;
-    bool success = tox_file_send_chunk(tox, friendNum, fileNum, position, data(fileData), size(fileData), &toxErr);
+    bool success = tox_file_send_chunk(tox, friendNum, fileNum, position, chunk, length, &toxErr);
     fillErrFileSendChunk(toxErr, err);
+    if (success) {
+        monitor->sent(transferKey(friendNum, fileNum), position, length);
+    } else if (toxErr == TOX_ERR_FILE_SEND_CHUNK_SENDQ) {
+        monitor->rejected(transferKey(friendNum, fileNum));
+    }
+
     return success;
 }
 
+void Files::iterate()
+{
+    // rejected chunks were scheduled already, they go out first
+    auto unreadable = QVector<quint64>{};
+    sendq->iterate([this, &unreadable](quint64 key, const SendqChunk& chunk) {
+        return resendChunk(key, chunk, &unreadable);
+    });
+
+    // canceling closes the transfer, which mustn't happen while Sendq iterates
+    for (const auto key : unreadable) {
+        fileControl(transferFriend(key), transferFile(key), FileControl::Cancel);
+    }
+
+    if (scheduling) {
+        for (const auto& request : scheduler->schedule()) {
+            serveChunkRequest(transferFriend(request.key), transferFile(request.key),
+                              request.position, request.length);
+        }
+
+        auto toPause = QVector<quint64>{};
+        auto toResume = QVector<quint64>{};
+        scheduler->pressure(&toPause, &toResume);
+        for (const auto key : toPause) {
+            controlTransfer(transferFriend(key), transferFile(key), FileControl::Pause);
+        }
+
+        for (const auto key : toResume) {
+            controlTransfer(transferFriend(key), transferFile(key), FileControl::Resume);
+        }
+    }
+
+    if (journal) {
+        journal->flushIfDue([this](quint64 key) { return receiveSink->sync(key); });
+    }
+}
+
+bool Files::fileReceiveTo(uint32_t friendNum, uint32_t fileNum, const QString& path,
+                          Files::ErrFileReceiveTo* err)
+{
+    const auto key = transferKey(friendNum, fileNum);
+    const auto resume = resumed.contains(key);
+    if (!receiveSink->open(key, path, resume, err)) {
+        return false;
+    }
+
+    resumed.remove(key);
+    if (journal) {
+        const auto fileId = getFileId(friendNum, fileNum);
+        const auto publicKey = friendPublicKey(tox, friendNum);
+        if (!fileId.isEmpty() && !publicKey.isEmpty()) {
+            journal->begin(key, fileId, publicKey, path, receiveSink->size(key));
+        }
+    }
+
+    return true;
+}
+
+bool Files::openTransferJournal(const QString& path)
+{
+    journal.reset(new TransferJournal);
+    if (!journal->open(path)) {
+        journal.reset();
+        return false;
+    }
+
+    return true;
+}
+
+bool Files::openAvatarCache(const QString& directory, uint64_t maxAvatarSize)
+{
+    avatarCache.reset(new AvatarCache{maxAvatarSize});
+    if (!avatarCache->open(directory)) {
+        avatarCache.reset();
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t Files::avatarSend(uint32_t friendNum, const QByteArray& avatar, Files::ErrFileSend* err)
+{
+    if (avatar.isEmpty()) {
+        // an empty avatar transfer tells the friend we have none
+        return fileSend(friendNum, FileKind::Avatar, 0, {}, {}, err);
+    }
+
+    if (!avatarCache) {
+        if (err) {
+            *err = ErrFileSend::OpenFailed;
+        }
+
+        return UINT32_MAX;
+    }
+
+    const auto fileId = avatarCache->ownHash(avatar);
+    const auto path = avatarCache->store(fileId, avatar);
+    if (path.isEmpty()) {
+        if (err) {
+            *err = ErrFileSend::OpenFailed;
+        }
+
+        return UINT32_MAX;
+    }
+
+    return fileSendFromDisk(friendNum, FileKind::Avatar, path, fileId, {}, err);
+}
+
+void Files::setTransferScheduling(bool enabled)
+{
+    if (scheduling && !enabled) {
+        // hand out what is queued, nothing else would request it again
+        for (const auto& request : scheduler->takeAll()) {
+            serveChunkRequest(transferFriend(request.key), transferFile(request.key),
+                              request.position, request.length);
+        }
+    }
+
+    scheduling = enabled;
+}
+
+void Files::setSendBandwidthLimit(uint64_t bytesPerSecond)
+{
+    scheduler->setBandwidthLimit(bytesPerSecond);
+}
+
+void Files::setFriendWeight(uint32_t friendNum, uint32_t weight)
+{
+    scheduler->setFriendWeight(friendNum, weight);
+}
+
+Files::TransferThroughput Files::getSendThroughput(FileKind kind) const
+{
+    return scheduler->getThroughput(kind);
+}
+
+Files::TransferStats Files::getTransferStats(uint32_t friendNum, uint32_t fileNum) const
+{
+    return monitor->getTransferStats(transferKey(friendNum, fileNum));
+}
+
+Files::TransferStats Files::getFriendTransferStats(uint32_t friendNum) const
+{
+    return monitor->getFriendStats(friendNum);
+}
+
+bool Files::handleFileChunkRequest(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+                                   size_t length)
+{
+    if (length != 0) {
+        monitor->requested(transferKey(friendNum, fileNum), position);
+    }
+
+    if (scheduling) {
+        // the final empty request is queued too, it must not overtake data
+        scheduler->enqueue(transferKey(friendNum, fileNum), position, length);
+        return true;
+    }
+
+    const auto key = transferKey(friendNum, fileNum);
+    if (!sendSource->contains(key)) {
+        if (length == 0) {
+            scheduler->forget(key);
+            monitor->finish(key);
+        }
+
+        return false;
+    }
+
+    serveChunkRequest(friendNum, fileNum, position, length);
+    return true;
+}
+
+void Files::serveChunkRequest(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+                              size_t length)
+{
+    const auto key = transferKey(friendNum, fileNum);
+    if (length == 0) {
+        scheduler->forget(key);
+        monitor->finish(key);
+    }
+
+    if (!sendSource->contains(key)) {
+        emit fileChunkRequest(friendNum, fileNum, position, length);
+        return;
+    }
+
+    const auto request = SendqChunk{position, length, {}, {}};
+    if (sendq->isBlocked(key)) {
+        // the end of the transfer must not overtake waiting chunks either
+        sendq->defer(key, request);
+        return;
+    }
+
+    if (length == 0) {
+        sendSource->close(key);
+        return;
+    }
+
+    const auto chunk = sendSource->read(key, position, length);
+    if (!chunk) {
+        fileControl(friendNum, fileNum, FileControl::Cancel);
+        return;
+    }
+
+    sendOrDefer(friendNum, fileNum, request, chunk);
+}
+
+bool Files::sendOrDefer(uint32_t friendNum, uint32_t fileNum, const SendqChunk& chunk,
+                        const uint8_t* data, ErrFileSendChunk* err)
+{
+    const auto key = transferKey(friendNum, fileNum);
+    auto sendErr = ErrFileSendChunk::Ok;
+    // toxcore only accepts chunks in order, so nothing may pass a waiting chunk
+    if (!sendq->isBlocked(key)) {
+        if (sendChunk(friendNum, fileNum, chunk.position, data, chunk.length, &sendErr)) {
+            if (err) {
+                *err = ErrFileSendChunk::Ok;
+            }
+
+            return true;
+        }
+
+        if (sendErr != ErrFileSendChunk::Sendq) {
+            if (err) {
+                *err = sendErr;
+            }
+
+            return false;
+        }
+
+        sendq->rejected(friendNum);
+    }
+
+    // toxcore doesn't request a chunk twice, it is resent from iterate()
+    sendq->defer(key, chunk);
+    if (err) {
+        *err = ErrFileSendChunk::Ok;
+    }
+
+    return true;
+}
+
+/**
+ * @param unreadable Collects transfers whose file can't be read anymore, the
+ * caller cancels them.
+ */
+Files::ErrFileSendChunk Files::resendChunk(quint64 key, const SendqChunk& chunk,
+                                           QVector<quint64>* unreadable)
+{
+    const auto friendNum = transferFriend(key);
+    const auto fileNum = transferFile(key);
+    const uint8_t* data = nullptr;
+    if (!chunk.buffer.isNull()) {
+        data = chunk.buffer.data();
+    } else if (!chunk.bytes.isNull()) {
+        data = reinterpret_cast<const uint8_t*>(chunk.bytes.constData());
+    } else if (!sendSource->contains(key)) {
+        return ErrFileSendChunk::NotFound;
+    } else if (chunk.length == 0) {
+        sendSource->close(key);
+        return ErrFileSendChunk::Ok;
+    } else {
+        data = sendSource->read(key, chunk.position, chunk.length);
+        if (!data) {
+            unreadable->append(key);
+            return ErrFileSendChunk::NotFound;
+        }
+    }
+
+    auto err = ErrFileSendChunk::Ok;
+    sendChunk(friendNum, fileNum, chunk.position, data, chunk.length, &err);
+    return err;
+}
+
+bool Files::handleFileReceive(uint32_t friendNum, uint32_t fileNum, FileKind kind,
+                              uint64_t fileSize)
+{
+    const auto key = transferKey(friendNum, fileNum);
+    receiveSink->announce(key, fileSize);
+    resumed.remove(key);
+    if (avatarCache) {
+        avatarCache->drop(key);
+    }
+
+    if (kind == FileKind::Avatar && avatarCache && fileSize > 0) {
+        const auto fileId = getFileId(friendNum, fileNum);
+        if (avatarCache->contains(fileId)) {
+            const auto avatar = avatarCache->load(fileId);
+            if (!avatar.isEmpty() && fileControl(friendNum, fileNum, FileControl::Cancel)) {
+                emit avatarReceived(friendNum, fileId, avatar);
+                return true;
+            }
+        }
+
+        avatarCache->begin(key, fileId, fileSize);
+        return false;
+    }
+
+    if (!journal || kind != FileKind::Data) {
+        return false;
+    }
+
+    journal->detach(key);
+    auto entry = TransferJournal::Entry{};
+    const auto fileId = getFileId(friendNum, fileNum);
+    const auto publicKey = friendPublicKey(tox, friendNum);
+    if (!journal->find(fileId, publicKey, &entry) || entry.size != fileSize) {
+        return false;
+    }
+
+    const auto position = TransferJournal::firstMissing(entry);
+    if (position > 0 && position < fileSize && fileSeek(friendNum, fileNum, position)) {
+        resumed.insert(key, position);
+        emit fileReceiveResumable(friendNum, fileNum, position, entry.path);
+    }
+
+    return false;
+}
+
+void Files::handleFileReceiveChunk(uint32_t friendNum, uint32_t fileNum, uint64_t position,
+                                   const uint8_t* data, size_t length)
+{
+    const auto key = transferKey(friendNum, fileNum);
+    if (length == 0) {
+        monitor->finish(key);
+    } else {
+        monitor->received(key, length);
+    }
+
+    if (journal) {
+        if (length == 0) {
+            journal->remove(key);
+        } else {
+            journal->received(key, position, length);
+        }
+    }
+
+    if (avatarCache) {
+        auto fileId = QByteArray{};
+        auto avatar = QByteArray{};
+        if (length != 0) {
+            avatarCache->append(key, position, data, length);
+        } else if (avatarCache->finish(key, &fileId, &avatar)) {
+            emit avatarReceived(friendNum, fileId, avatar);
+        }
+    }
+
+    if (receiveSink->write(key, position, data, length) && length != 0) {
+        return;
+    }
+
+    // build only the representations somebody listens to, the empty chunk
+    // marking completion is emitted for sink transfers as well
+    static const auto bufferSignal = QMetaMethod::fromSignal(&Files::fileChunkBufferReceived);
+    static const auto byteArraySignal = QMetaMethod::fromSignal(&Files::fileChunkReceived);
+    if (isSignalConnected(bufferSignal)) {
+        const auto chunk = length ? ChunkBuffer::copy(data, length) : ChunkBuffer{};
+        emit fileChunkBufferReceived(friendNum, fileNum, position, chunk);
+    }
+
+    if (isSignalConnected(byteArraySignal)) {
+        emit fileChunkReceived(friendNum, fileNum, position, bytes(data, length));
+    }
+}
+
+void Files::handleFileReceiveControl(uint32_t friendNum, uint32_t fileNum, FileControl control)
+{
+    if (control == FileControl::Cancel) {
+        closeTransfer(transferKey(friendNum, fileNum));
+    }
+}
+
+void Files::closeTransfer(quint64 key)
+{
+    receiveSink->close(key);
+    sendSource->close(key);
+    sendq->forget(key);
+    scheduler->forget(key);
+    monitor->finish(key);
+    resumed.remove(key);
+    if (avatarCache) {
+        avatarCache->drop(key);
+    }
+
+    if (journal) {
+        journal->remove(key);
+    }
+}
+
 }
@@ -0,0 +1,130 @@
+#include "filesendsource.h"
+
+#include "fileprefetch.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <algorithm>
+
+namespace
+{
+
+const uint64_t WindowSize = 4 * 1024 * 1024;
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class FileSendSource
+ * @brief Serves chunk requests of outgoing transfers from files on disk.
+ *
+ * Each file is accessed through a memory mapped window that moves along
+ * with the requested positions, so chunks are handed to toxcore without a
+ * copy. Whenever a new window is mapped the following one is prefetched
+ * into the page cache. Positions are 64 bit throughout and arbitrary jumps,
+ * e.g. after the receiver seeked to resume a transfer, just remap.
+ */
+
+FileSendSource::~FileSendSource()
+{
+    for (auto& source : sources) {
+        release(source);
+    }
+}
+
+/**
+ * @brief Takes ownership of an opened file to serve the transfer from.
+ */
+void FileSendSource::add(quint64 key, QFile* file)
+{
+    close(key);
+    const auto size = static_cast<uint64_t>(file->size());
+    sources.insert(key, Source{file, size, nullptr, 0, 0});
+    prefetch(*file, 0, std::min(size, WindowSize));
+}
+
+bool FileSendSource::contains(quint64 key) const
+{
+    return sources.contains(key);
+}
+
+/**
+ * @brief Gets the data of a chunk.
+ * @return Pointer to length bytes at position, valid until the next call,
+ *         or nullptr if the range can't be read.
+ */
+const uint8_t* FileSendSource::read(quint64 key, uint64_t position, size_t length)
+{
+    auto it = sources.find(key);
+    if (it == sources.end()) {
+        return nullptr;
+    }
+
+    auto& source = *it;
+    if (position > source.size || length > source.size - position) {
+        qWarning() << "Chunk request beyond the end of the file at" << position;
+        return nullptr;
+    }
+
+    const auto inWindow = source.window && position >= source.windowStart
+        && position + length <= source.windowStart + source.windowSize;
+    if (!inWindow && !remap(source, position, length)) {
+        return nullptr;
+    }
+
+    return source.window + (position - source.windowStart);
+}
+
+/**
+ * @brief Releases the file of a finished or canceled transfer.
+ */
+void FileSendSource::close(quint64 key)
+{
+    auto it = sources.find(key);
+    if (it == sources.end()) {
+        return;
+    }
+
+    release(*it);
+    sources.erase(it);
+}
+
+bool FileSendSource::remap(Source& source, uint64_t position, size_t length)
+{
+    if (source.window) {
+        source.file->unmap(source.window);
+        source.window = nullptr;
+    }
+
+    const auto size = std::max<uint64_t>(std::min(WindowSize, source.size - position), length);
+    source.window = source.file->map(static_cast<qint64>(position), static_cast<qint64>(size));
+    if (!source.window) {
+        qWarning() << "Can't map" << source.file->fileName() << source.file->errorString();
+        return false;
+    }
+
+    source.windowStart = position;
+    source.windowSize = size;
+    const auto next = position + size;
+    if (next < source.size) {
+        prefetch(*source.file, next, std::min(WindowSize, source.size - next));
+    }
+
+    return true;
+}
+
+void FileSendSource::release(Source& source)
+{
+    if (source.window) {
+        source.file->unmap(source.window);
+    }
+
+    source.file->close();
+    delete source.file;
+    source.file = nullptr;
+}
+
+}
@@ -0,0 +1,46 @@
+#ifndef _QT_TOX_FILE_SEND_SOURCE_H_
+#define _QT_TOX_FILE_SEND_SOURCE_H_
+
+#include <QHash>
+
+#include <cstddef>
+#include <cstdint>
+
+class QFile;
+
+namespace QtTox
+{
+
+class FileSendSource
+{
+public:
+    FileSendSource() = default;
+    FileSendSource(const FileSendSource& other) = delete;
+    FileSendSource& operator=(const FileSendSource& other) = delete;
+    ~FileSendSource();
+
+    void add(quint64 key, QFile* file);
+    bool contains(quint64 key) const;
+    const uint8_t* read(quint64 key, uint64_t position, size_t length);
+    void close(quint64 key);
+
+private:
+    struct Source
+    {
+        QFile* file;
+        uint64_t size;
+        uchar* window;
+        uint64_t windowStart;
+        uint64_t windowSize;
+    };
+
+    bool remap(Source& source, uint64_t position, size_t length);
+    void release(Source& source);
+
+private:
+    QHash<quint64, Source> sources;
+};
+
+}
+
+#endif // _QT_TOX_FILE_SEND_SOURCE_H_
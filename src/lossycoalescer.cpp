@@ -0,0 +1,216 @@
+#include "lossycoalescer.h"
+
+#include "common.h"
+#include "datahelper.h"
+
+namespace
+{
+
+// packets are at most MaxCustomPacketSize long, which fits two varint bytes
+const size_t MaxLengthSize = 2;
+// toxcore's lossy id range, only those may travel in a frame
+const uint8_t FirstLossyId = 192;
+const uint8_t LastLossyId = 254;
+
+bool isLossyId(uint8_t packetId)
+{
+    return packetId >= FirstLossyId && packetId <= LastLossyId;
+}
+
+size_t lengthSize(size_t length)
+{
+    return length < 0x80 ? 1 : 2;
+}
+
+void appendLength(QByteArray& frame, size_t length)
+{
+    if (length < 0x80) {
+        frame.append(static_cast<char>(length));
+        return;
+    }
+
+    frame.append(static_cast<char>(0x80 | (length & 0x7f)));
+    frame.append(static_cast<char>(length >> 7));
+}
+
+bool readLength(const uint8_t*& data, const uint8_t* end, size_t* length)
+{
+    if (data == end) {
+        return false;
+    }
+
+    *length = *data & 0x7f;
+    if ((*data++ & 0x80) == 0) {
+        return true;
+    }
+
+    if (data == end) {
+        return false;
+    }
+
+    *length |= static_cast<size_t>(*data++) << 7;
+    return true;
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class LossyCoalescer
+ * @brief Packs small lossy packets to the same friend into shared frames.
+ *
+ * Packets passed to send() are complete lossy custom packets with their own
+ * packet id. They are appended to a frame per friend, prefixed by a one or
+ * two byte length, and the frame goes out as one custom packet when the
+ * next packet wouldn't fit or on iterate(). The receiving side splits the
+ * frame and hands every packet to the LowLevel dispatcher, so handlers see
+ * the same packets as without coalescing. A frame holding a single packet
+ * is sent as that packet, and so are packets too large to share a frame.
+ */
+
+/**
+ * @param lowLevel Service used to send frames and to dispatch their content.
+ * @param packetId First byte of the frames, must be the same on both sides.
+ */
+LossyCoalescer::LossyCoalescer(LowLevel* lowLevel, uint8_t packetId)
+    : lowLevel{lowLevel}
+    , packetId{packetId}
+{
+    lowLevel->setPacketHandler(packetId, [this](uint32_t friendNum, const uint8_t* data,
+                                                size_t length) {
+        handleFrame(friendNum, data, length);
+    });
+}
+
+LossyCoalescer::~LossyCoalescer()
+{
+    lowLevel->setPacketHandler(packetId, nullptr);
+}
+
+/**
+ * @brief Queues a lossy packet for the friend.
+ * @return False if the packet is invalid. Failed frame sends are only
+ * counted, lossy packets may get lost anyway.
+ */
+bool LossyCoalescer::send(uint32_t friendNum, const QByteArray& packet,
+        LowLevel::ErrFriendCustomPacket* err)
+{
+    if (packet.isEmpty() || static_cast<uint8_t>(packet[0]) == packetId
+            || !isLossyId(static_cast<uint8_t>(packet[0]))) {
+        if (err) {
+            *err = packet.isEmpty() ? LowLevel::ErrFriendCustomPacket::Empty
+                                    : LowLevel::ErrFriendCustomPacket::Invalid;
+        }
+
+        return false;
+    }
+
+    ++packetCount;
+    const auto length = size(packet);
+    if (1 + MaxLengthSize + length > MaxCustomPacketSize) {
+        ++frameCount;
+        return lowLevel->friendSendLossyPacket(friendNum, packet, err);
+    }
+
+    auto& frame = frames[friendNum];
+    if (size(frame.bytes) + lengthSize(length) + length > MaxCustomPacketSize) {
+        flush(friendNum, frame);
+    }
+
+    if (frame.bytes.isEmpty()) {
+        frame.bytes.reserve(static_cast<int>(MaxCustomPacketSize));
+        frame.bytes.append(static_cast<char>(packetId));
+    }
+
+    appendLength(frame.bytes, length);
+    frame.bytes.append(packet);
+    ++frame.packets;
+    if (err) {
+        *err = LowLevel::ErrFriendCustomPacket::Ok;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Sends all partially filled frames, call after each Core::iterate().
+ */
+void LossyCoalescer::iterate()
+{
+    for (auto it = frames.begin(); it != frames.end(); ++it) {
+        if (it->packets > 0) {
+            flush(it.key(), *it);
+        }
+    }
+}
+
+/**
+ * @brief Number of packets passed to send().
+ */
+uint64_t LossyCoalescer::getPacketCount() const
+{
+    return packetCount;
+}
+
+/**
+ * @brief Number of custom packets sent for them.
+ */
+uint64_t LossyCoalescer::getFrameCount() const
+{
+    return frameCount;
+}
+
+/**
+ * @brief Number of packets lost to failed frame sends.
+ */
+uint64_t LossyCoalescer::getDroppedCount() const
+{
+    return dropped;
+}
+
+void LossyCoalescer::flush(uint32_t friendNum, Frame& frame)
+{
+    auto success = false;
+    if (frame.packets == 1) {
+        // skip the frame header, the packet is dispatched by its own id
+        const auto& bytes = frame.bytes;
+        const auto end = data(bytes) + size(bytes);
+        auto packet = data(bytes) + 1;
+        auto length = size_t{0};
+        readLength(packet, end, &length);
+        success = lowLevel->friendSendLossyPacket(friendNum, packet, length);
+    } else {
+        success = lowLevel->friendSendLossyPacket(friendNum, frame.bytes);
+    }
+
+    ++frameCount;
+    if (!success) {
+        dropped += static_cast<uint64_t>(frame.packets);
+    }
+
+    frame.bytes.resize(0);
+    frame.packets = 0;
+}
+
+void LossyCoalescer::handleFrame(uint32_t friendNum, const uint8_t* data, size_t length)
+{
+    auto packet = data + 1;
+    const auto end = data + length;
+    while (packet != end) {
+        auto packetLength = size_t{0};
+        if (!readLength(packet, end, &packetLength)
+                || packetLength == 0 || packetLength > static_cast<size_t>(end - packet)
+                || *packet == packetId || !isLossyId(*packet)) {
+            // malformed, the rest of the frame can't be trusted
+            return;
+        }
+
+        // straight to the handler, control and decompression are lossless only
+        lowLevel->dispatch(friendNum, packet, packetLength);
+        packet += packetLength;
+    }
+}
+
+}
@@ -0,0 +1,465 @@
+#include "lowlevel.h"
+
+#include "common.h"
+#include "datahelper.h"
+#include "fillerror.h"
+#include "packetcodec.h"
+#include "services.h"
+
+#include <QElapsedTimer>
+#include <QMap>
+
+#include <cstring>
+
+#include <tox/tox.h>
+
+namespace
+{
+
+const uint8_t FirstLosslessId = 160;
+const uint8_t ControlPacketId = 191;
+// packet id, message type, channel id and dictionary id
+const size_t ControlSize = 7;
+// adler32 is never 0, so 0 stands for no dictionary
+const uint32_t NoDictionary = 0;
+// compressed packets may expand to more than fits a custom packet
+const size_t MaxDecompressedSize = 64 * 1024;
+
+enum Trailer : uint8_t
+{
+    Raw = 0,
+    Deflate = 1,
+};
+
+enum Control : uint8_t
+{
+    // offers the dictionary of a channel, a request asks for an offer back
+    HelloRequest = 0,
+    HelloReply = 1,
+    // the sender's packets of the channel carry a trailer from here on
+    Enable = 2,
+    // the sender's packets of the channel carry no trailer from here on
+    Disable = 3,
+};
+
+uint32_t channelBit(uint8_t packetId)
+{
+    return 1u << (packetId - FirstLosslessId);
+}
+
+template<class ToxErr, class Err>
+void fillErrFriendCustomPacket(ToxErr toxErr, Err* err)
+{
+#define ERR(toxName, qtName) \
+    { TOX_ERR_FRIEND_CUSTOM_PACKET_##toxName, \
+      QtTox::LowLevel::ErrFriendCustomPacket::qtName }
+    fillError(toxErr, err, {
+        ERR(OK,                   Ok),
+        ERR(NULL,                 Null),
+        ERR(FRIEND_NOT_FOUND,     FriendNotFound),
+        ERR(FRIEND_NOT_CONNECTED, FriendNotConnected),
+        ERR(INVALID,              Invalid),
+        ERR(EMPTY,                Empty),
+        ERR(TOO_LONG,             TooLong),
+        ERR(SENDQ,                Sendq),
+    });
+#undef ERR
+}
+
+template<class ToxErr, class Err>
+void fillErrGetPort(ToxErr toxErr, Err* err)
+{
+#define ERR(toxName, qtName) \
+    { TOX_ERR_GET_PORT_##toxName, QtTox::LowLevel::ErrGetPort::qtName }
+    fillError(toxErr, err, {
+        ERR(OK,        Ok),
+        ERR(NOT_BOUND, NotBound),
+    });
+#undef ERR
+}
+
+void onFriendLossyPacket(Tox* tox, uint32_t friendNum, const uint8_t* data,
+        size_t length, void* payload)
+{
+    auto service = static_cast<QtTox::Services*>(payload);
+    service->lowLevel->handlePacket(friendNum, data, length);
+}
+
+void onFriendLosslessPacket(Tox* tox, uint32_t friendNum, const uint8_t* data,
+        size_t length, void* payload)
+{
+    auto service = static_cast<QtTox::Services*>(payload);
+    service->lowLevel->handlePacket(friendNum, data, length);
+}
+
+}
+
+namespace QtTox
+{
+
+LowLevel::LowLevel(struct Tox* tox)
+    : receiveBuffer(static_cast<int>(MaxDecompressedSize + 1), Qt::Uninitialized)
+    , sendBuffer(static_cast<int>(MaxCustomPacketSize), Qt::Uninitialized)
+{
+    tox_callback_friend_lossy_packet(tox, onFriendLossyPacket);
+    tox_callback_friend_lossless_packet(tox, onFriendLosslessPacket);
+    this->tox = tox;
+}
+
+LowLevel::~LowLevel() = default;
+
+bool LowLevel::friendSendLossyPacket(uint32_t friendNum, const QByteArray& packet,
+        ErrFriendCustomPacket* err)
+{
+    return friendSendLossyPacket(friendNum, data(packet), size(packet), err);
+}
+
+bool LowLevel::friendSendLossyPacket(uint32_t friendNum, const uint8_t* packet, size_t length,
+        ErrFriendCustomPacket* err)
+{
+    TOX_ERR_FRIEND_CUSTOM_PACKET toxErr;
+    const auto success = tox_friend_send_lossy_packet(tox, friendNum, packet, length, &toxErr);
+    fillErrFriendCustomPacket(toxErr, err);
+    return success;
+}
+
+bool LowLevel::friendSendLossLessPacket(uint32_t friendNum, const QByteArray& packet,
+        ErrFriendCustomPacket* err)
+{
+    return friendSendLossLessPacket(friendNum, data(packet), size(packet), err);
+}
+
+bool LowLevel::friendSendLossLessPacket(uint32_t friendNum, const uint8_t* packet, size_t length,
+        ErrFriendCustomPacket* err)
+{
+    const auto codec = length > 0 ? codecFor(friendNum, packet[0]) : nullptr;
+    if (!codec) {
+        TOX_ERR_FRIEND_CUSTOM_PACKET toxErr;
+        const auto success = tox_friend_send_lossless_packet(tox, friendNum, packet, length, &toxErr);
+        fillErrFriendCustomPacket(toxErr, err);
+        return success;
+    }
+
+    // not receiveBuffer, handlers may send while their input still sits there
+    auto out = data(sendBuffer);
+    auto outLength = size_t{0};
+    out[0] = packet[0];
+    if (length >= static_cast<size_t>(codec->getThreshold())) {
+        QElapsedTimer timer;
+        timer.start();
+        const auto body = codec->compress(packet + 1, length - 1, out + 1, MaxCustomPacketSize - 2);
+        compressionStats.compressNs += static_cast<uint64_t>(timer.nsecsElapsed());
+        if (body > 0 && body < length - 1) {
+            out[1 + body] = Trailer::Deflate;
+            outLength = body + 2;
+            ++compressionStats.packets;
+            compressionStats.rawBytes += length;
+            compressionStats.compressedBytes += outLength;
+        }
+    }
+
+    // the trailer byte tells the receiver whether the body is compressed
+    if (outLength == 0) {
+        if (length + 1 > MaxCustomPacketSize) {
+            if (err) {
+                *err = ErrFriendCustomPacket::TooLong;
+            }
+
+            return false;
+        }
+
+        memcpy(out + 1, packet + 1, length - 1);
+        out[length] = Trailer::Raw;
+        outLength = length + 1;
+    }
+
+    TOX_ERR_FRIEND_CUSTOM_PACKET toxErr;
+    const auto success = tox_friend_send_lossless_packet(tox, friendNum, out, outLength, &toxErr);
+    fillErrFriendCustomPacket(toxErr, err);
+    return success;
+}
+
+/**
+ * @brief Enables compression of lossless packets with the given id.
+ * @param dictionary Strings the packets usually contain, e.g. common JSON
+ * keys. Up to 32 KiB are used, both sides must pass the same bytes.
+ * @param threshold Shorter packets are sent uncompressed.
+ * @return False if the id is not a lossless custom packet id.
+ *
+ * Compressed packets may be longer than MaxCustomPacketSize before
+ * compression and up to 64 KiB after decompression. Uncompressed packets
+ * to a negotiated friend carry one trailer byte, which they must have room for.
+ * Friends already negotiated with are offered the new dictionary.
+ */
+bool LowLevel::setCompression(uint8_t packetId, const QByteArray& dictionary, int threshold)
+{
+    if (packetId < FirstLosslessId || packetId >= ControlPacketId) {
+        return false;
+    }
+
+    replaceCodec(packetId, std::unique_ptr<PacketCodec>{
+            new PacketCodec{dictionary.right(32 * 1024), threshold}});
+    return true;
+}
+
+/**
+ * @brief Disables compression of lossless packets with the given id.
+ * @return False if the id is not a lossless custom packet id.
+ */
+bool LowLevel::clearCompression(uint8_t packetId)
+{
+    if (packetId < FirstLosslessId || packetId >= ControlPacketId) {
+        return false;
+    }
+
+    replaceCodec(packetId, nullptr);
+    return true;
+}
+
+/**
+ * @brief Offers the compressed packet ids to a friend, call when it comes online.
+ */
+void LowLevel::negotiateCompression(uint32_t friendNum)
+{
+    negotiations[friendNum];
+    for (auto packetId = FirstLosslessId; packetId < ControlPacketId; ++packetId) {
+        if (codecs[packetId - FirstLosslessId]) {
+            sendControl(friendNum, Control::HelloRequest, packetId);
+        }
+    }
+}
+
+/**
+ * @brief Forgets what was negotiated with a friend, call when it goes offline.
+ */
+void LowLevel::forgetFriend(uint32_t friendNum)
+{
+    negotiations.remove(friendNum);
+}
+
+/**
+ * @brief Counters to judge the ratio and the CPU cost of compression.
+ */
+LowLevel::CompressionStats LowLevel::getCompressionStats() const
+{
+    return compressionStats;
+}
+
+/**
+ * @brief Routes received custom packets with the given first byte to a handler.
+ * @param handler Replaces the previous handler, an empty one unregisters it.
+ *
+ * Lossy and lossless packets use disjoint id ranges, so one table serves both.
+ */
+void LowLevel::setPacketHandler(uint8_t packetId, PacketHandler handler)
+{
+    handlers[packetId] = std::move(handler);
+}
+
+/**
+ * @brief Number of received packets no handler was registered for.
+ */
+uint64_t LowLevel::getUnhandledPacketCount() const
+{
+    return unhandled;
+}
+
+QByteArray LowLevel::getDhtId() const
+{
+    auto dhtId = QByteArray{};
+    dhtId.resize(TOX_PUBLIC_KEY_SIZE);
+    tox_self_get_dht_id(tox, data(dhtId));
+    return dhtId;
+}
+
+uint16_t LowLevel::getSelfUdpPort(ErrGetPort* err)
+{
+    TOX_ERR_GET_PORT toxErr;
+    const auto port = tox_self_get_udp_port(tox, &toxErr);
+    fillErrGetPort(toxErr, err);
+    return port;
+}
+
+uint16_t LowLevel::getSelfTcpPort(ErrGetPort* err)
+{
+    TOX_ERR_GET_PORT toxErr;
+    const auto port = tox_self_get_tcp_port(tox, &toxErr);
+    fillErrGetPort(toxErr, err);
+    return port;
+}
+
+void LowLevel::handlePacket(uint32_t friendNum, const uint8_t* data, size_t length)
+{
+    if (length > 0 && data[0] == ControlPacketId) {
+        handleControl(friendNum, data, length);
+        return;
+    }
+
+    // only an enable message from the friend adds the trailer, lossless
+    // ordering puts it ahead of the first packet that carries one
+    const auto lossless = length > 0 && data[0] >= FirstLosslessId && data[0] < ControlPacketId;
+    const auto it = lossless ? negotiations.constFind(friendNum) : negotiations.constEnd();
+    if (it == negotiations.constEnd() || !(it->receiving & channelBit(data[0]))) {
+        dispatch(friendNum, data, length);
+        return;
+    }
+
+    if (length < 2) {
+        ++compressionStats.failures;
+        return;
+    }
+
+    const auto trailer = data[length - 1];
+    if (trailer == Trailer::Raw) {
+        dispatch(friendNum, data, length - 1);
+        return;
+    }
+
+    const auto codec = decoderFor(data[0], it->dictionaries[data[0] - FirstLosslessId]);
+    auto out = ::data(receiveBuffer);
+    QElapsedTimer timer;
+    timer.start();
+    const auto body = trailer == Trailer::Deflate && codec
+                    ? codec->decompress(data + 1, length - 2, out + 1, MaxDecompressedSize)
+                    : 0;
+    compressionStats.decompressNs += static_cast<uint64_t>(timer.nsecsElapsed());
+    if (body == 0) {
+        ++compressionStats.failures;
+        return;
+    }
+
+    out[0] = data[0];
+    dispatch(friendNum, out, body + 1);
+}
+
+PacketCodec* LowLevel::codecFor(uint32_t friendNum, uint8_t packetId) const
+{
+    if (packetId < FirstLosslessId || packetId >= ControlPacketId) {
+        return nullptr;
+    }
+
+    // compress only after the friend was told the packets carry a trailer
+    const auto it = negotiations.constFind(friendNum);
+    if (it == negotiations.constEnd() || !(it->sending & channelBit(packetId))) {
+        return nullptr;
+    }
+
+    return codecs[packetId - FirstLosslessId].get();
+}
+
+PacketCodec* LowLevel::decoderFor(uint8_t packetId, uint32_t dictionaryId) const
+{
+    const auto& codec = codecs[packetId - FirstLosslessId];
+    if (codec && codec->getDictionaryId() == dictionaryId) {
+        return codec.get();
+    }
+
+    const auto& retired = retiredCodecs[packetId - FirstLosslessId];
+    if (retired && retired->getDictionaryId() == dictionaryId) {
+        return retired.get();
+    }
+
+    return nullptr;
+}
+
+void LowLevel::replaceCodec(uint8_t packetId, std::unique_ptr<PacketCodec> codec)
+{
+    // packets compressed with the old dictionary may still be on their way
+    const auto index = packetId - FirstLosslessId;
+    if (codecs[index]) {
+        retiredCodecs[index] = std::move(codecs[index]);
+    }
+
+    codecs[index] = std::move(codec);
+    const auto bit = channelBit(packetId);
+    for (auto it = negotiations.begin(); it != negotiations.end(); ++it) {
+        if (it->sending & bit) {
+            sendControl(it.key(), Control::Disable, packetId);
+            it->sending &= ~bit;
+        }
+
+        // an offer without a dictionary makes the friend stop compressing
+        sendControl(it.key(), Control::HelloRequest, packetId);
+    }
+}
+
+bool LowLevel::sendControl(uint32_t friendNum, uint8_t type, uint8_t packetId)
+{
+    const auto& codec = codecs[packetId - FirstLosslessId];
+    const auto dictionaryId = codec ? codec->getDictionaryId() : NoDictionary;
+    const uint8_t control[ControlSize] = {
+        ControlPacketId,
+        type,
+        packetId,
+        static_cast<uint8_t>(dictionaryId >> 24),
+        static_cast<uint8_t>(dictionaryId >> 16),
+        static_cast<uint8_t>(dictionaryId >> 8),
+        static_cast<uint8_t>(dictionaryId),
+    };
+
+    TOX_ERR_FRIEND_CUSTOM_PACKET toxErr;
+    return tox_friend_send_lossless_packet(tox, friendNum, control, ControlSize, &toxErr);
+}
+
+void LowLevel::handleControl(uint32_t friendNum, const uint8_t* data, size_t length)
+{
+    if (length < ControlSize || data[2] < FirstLosslessId || data[2] >= ControlPacketId) {
+        return;
+    }
+
+    const auto type = data[1];
+    const auto packetId = data[2];
+    const auto bit = channelBit(packetId);
+    const auto dictionaryId = (static_cast<uint32_t>(data[3]) << 24)
+                            | (static_cast<uint32_t>(data[4]) << 16)
+                            | (static_cast<uint32_t>(data[5]) << 8) | data[6];
+    auto& negotiation = negotiations[friendNum];
+    switch (type) {
+    case Control::HelloRequest:
+    case Control::HelloReply: {
+        const auto& codec = codecs[packetId - FirstLosslessId];
+        const auto match = codec && dictionaryId != NoDictionary
+                        && codec->getDictionaryId() == dictionaryId;
+        if (match && !(negotiation.sending & bit)) {
+            if (sendControl(friendNum, Control::Enable, packetId)) {
+                negotiation.sending |= bit;
+            }
+        } else if (!match && (negotiation.sending & bit)) {
+            if (sendControl(friendNum, Control::Disable, packetId)) {
+                negotiation.sending &= ~bit;
+            }
+        }
+
+        if (type == Control::HelloRequest && codec) {
+            sendControl(friendNum, Control::HelloReply, packetId);
+        }
+
+        break;
+    }
+    case Control::Enable:
+        negotiation.receiving |= bit;
+        negotiation.dictionaries[packetId - FirstLosslessId] = dictionaryId;
+        break;
+    case Control::Disable:
+        negotiation.receiving &= ~bit;
+        break;
+    }
+}
+
+void LowLevel::dispatch(uint32_t friendNum, const uint8_t* data, size_t length)
+{
+    if (length == 0) {
+        ++unhandled;
+        return;
+    }
+
+    const auto& handler = handlers[data[0]];
+    if (!handler) {
+        ++unhandled;
+        return;
+    }
+
+    handler(friendNum, data, length);
+}
+
+}
@@ -0,0 +1,198 @@
+#include "messagededup.h"
+
+#include <algorithm>
+
+namespace
+{
+
+const uint64_t FnvOffsetBasis = 14695981039346656037ULL;
+const uint64_t FnvPrime = 1099511628211ULL;
+
+uint64_t fnv1a(uint64_t hash, const uint8_t* data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= data[i];
+        hash *= FnvPrime;
+    }
+
+    return hash;
+}
+
+int tableSize(int entries)
+{
+    // keep the load factor at or below 1/2 so probe sequences stay short
+    auto size = 16;
+    while (size < entries * 2) {
+        size *= 2;
+    }
+
+    return size;
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class MessageDedup
+ * @brief Time-windowed set of message fingerprints used to suppress echoes.
+ *
+ * Fingerprints are kept in two fixed-size open addressing tables, one for the
+ * current and one for the previous time window. Once the window elapses or
+ * the current table reaches its share of the capacity, the tables rotate and
+ * the oldest generation is dropped. A fingerprint is therefore remembered for
+ * at least one window unless the capacity forces an early rotation, and
+ * memory never grows past the capacity given at construction.
+ */
+
+/**
+ * @brief Creates an empty dedupe set.
+ * @param windowMs Minimum time in milliseconds a fingerprint is remembered.
+ * @param capacity Maximum number of fingerprints kept over both windows.
+ */
+MessageDedup::MessageDedup(uint32_t windowMs, int capacity)
+    : window{windowMs}
+    , generationLimit{std::max(capacity / 2, 1)}
+{
+    const auto size = tableSize(generationLimit);
+    current.fill(0, size);
+    previous.fill(0, size);
+    mask = static_cast<uint64_t>(size - 1);
+    timer.start();
+}
+
+/**
+ * @brief Computes the fingerprint of a message with a non-cryptographic hash.
+ * @param key Sender identifier, e.g. the peer public key.
+ * @param text Message bytes in the c-toxcore representation.
+ * @return Non-zero 64 bit fingerprint.
+ */
+uint64_t MessageDedup::fingerprint(const uint8_t* key, size_t keyLength,
+        const uint8_t* text, size_t textLength)
+{
+    const uint8_t separator = 0xff;
+    auto hash = fnv1a(FnvOffsetBasis, key, keyLength);
+    hash = fnv1a(hash, &separator, 1);
+    hash = fnv1a(hash, text, textLength);
+    // zero marks an empty slot in the tables
+    return hash ? hash : 1;
+}
+
+/**
+ * @brief Checks the fingerprint against the window and records it.
+ * @return True if the fingerprint was already seen in the window.
+ */
+bool MessageDedup::isDuplicate(uint64_t fingerprint)
+{
+    const auto seen = wasSeen(fingerprint);
+    // refreshing repeats keeps a looping message suppressed for as long as it loops
+    record(fingerprint);
+    return seen;
+}
+
+/**
+ * @brief Checks the fingerprint against the window without recording it,
+ * e.g. before an attempt that may fail. Call record() once it succeeded.
+ * @return True if the fingerprint was already seen in the window.
+ */
+bool MessageDedup::wasSeen(uint64_t fingerprint)
+{
+    expire();
+    if (contains(current, fingerprint) || contains(previous, fingerprint)) {
+        ++suppressed;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Records the fingerprint as seen now.
+ */
+void MessageDedup::record(uint64_t fingerprint)
+{
+    expire();
+    if (contains(current, fingerprint)) {
+        return;
+    }
+
+    if (currentCount >= generationLimit) {
+        rotate();
+    }
+
+    insert(current, fingerprint);
+}
+
+bool MessageDedup::isDuplicate(const uint8_t* key, size_t keyLength,
+        const uint8_t* text, size_t textLength)
+{
+    return isDuplicate(fingerprint(key, keyLength, text, textLength));
+}
+
+/**
+ * @brief Number of messages reported as duplicates since construction.
+ */
+uint64_t MessageDedup::getSuppressedCount() const
+{
+    return suppressed;
+}
+
+/**
+ * @brief Forgets all fingerprints.
+ */
+void MessageDedup::clear()
+{
+    rotate();
+    rotate();
+}
+
+bool MessageDedup::contains(const QVector<uint64_t>& table, uint64_t fingerprint) const
+{
+    auto slot = fingerprint & mask;
+    while (table[slot] != 0) {
+        if (table[slot] == fingerprint) {
+            return true;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    return false;
+}
+
+void MessageDedup::insert(QVector<uint64_t>& table, uint64_t fingerprint)
+{
+    auto slot = fingerprint & mask;
+    while (table[slot] != 0) {
+        if (table[slot] == fingerprint) {
+            return;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    table[slot] = fingerprint;
+    ++currentCount;
+}
+
+void MessageDedup::expire()
+{
+    const auto now = timer.elapsed();
+    if (now - rotatedAt >= 2 * window) {
+        rotate();
+        rotate();
+    } else if (now - rotatedAt >= window) {
+        rotate();
+    }
+}
+
+void MessageDedup::rotate()
+{
+    current.swap(previous);
+    current.fill(0);
+    currentCount = 0;
+    rotatedAt = timer.elapsed();
+}
+
+}
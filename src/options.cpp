@@ -0,0 +1,112 @@
+#include "options.h"
+
+namespace QtTox
+{
+
+/**
+ * @class Options
+ * @brief Settings used to create the Tox instance of a Core.
+ *
+ * The defaults match the toxcore defaults, a port range of 0 to 0 lets
+ * toxcore pick a port from its own default range.
+ */
+
+bool Options::getIpv6Enabled() const
+{
+    return ipv6Enabled;
+}
+
+void Options::setIpv6Enabled(bool enabled)
+{
+    ipv6Enabled = enabled;
+}
+
+bool Options::getUdpEnabled() const
+{
+    return udpEnabled;
+}
+
+void Options::setUdpEnabled(bool enabled)
+{
+    udpEnabled = enabled;
+}
+
+bool Options::getLocalDiscoveryEnabled() const
+{
+    return localDiscoveryEnabled;
+}
+
+void Options::setLocalDiscoveryEnabled(bool enabled)
+{
+    localDiscoveryEnabled = enabled;
+}
+
+Options::ToxProxyType Options::getProxyType() const
+{
+    return proxyType;
+}
+
+QString Options::getProxyHost() const
+{
+    return proxyHost;
+}
+
+uint16_t Options::getProxyPort() const
+{
+    return proxyPort;
+}
+
+void Options::setProxy(ToxProxyType type, const QString& host, uint16_t port)
+{
+    proxyType = type;
+    proxyHost = host;
+    proxyPort = port;
+}
+
+uint16_t Options::getStartPort() const
+{
+    return startPort;
+}
+
+uint16_t Options::getEndPort() const
+{
+    return endPort;
+}
+
+void Options::setPortRange(uint16_t start, uint16_t end)
+{
+    startPort = start;
+    endPort = end;
+}
+
+uint16_t Options::getTcpPort() const
+{
+    return tcpPort;
+}
+
+void Options::setTcpPort(uint16_t port)
+{
+    tcpPort = port;
+}
+
+Options::ToxSaveDataType Options::getSavedataType() const
+{
+    return savedataType;
+}
+
+QByteArray Options::getSavedata() const
+{
+    return savedata;
+}
+
+/**
+ * @param savedata Plain savedata, decrypt an encrypted profile first, e.g.
+ * with ProfileLoader.
+ */
+void Options::setSavedata(ToxSaveDataType type, const QByteArray& savedata)
+{
+    savedataType = type;
+    this->savedata = savedata;
+}
+
+}
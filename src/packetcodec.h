@@ -0,0 +1,40 @@
+#ifndef _QT_TOX_PACKET_CODEC_H_
+#define _QT_TOX_PACKET_CODEC_H_
+
+#include <QByteArray>
+
+#include <cstddef>
+#include <cstdint>
+
+#include <zlib.h>
+
+namespace QtTox
+{
+
+class PacketCodec
+{
+public:
+    PacketCodec(const QByteArray& dictionary, int threshold);
+    PacketCodec(const PacketCodec& other) = delete;
+    PacketCodec& operator=(const PacketCodec& other) = delete;
+    ~PacketCodec();
+
+    uint32_t getDictionaryId() const;
+    int getThreshold() const;
+
+    size_t compress(const uint8_t* data, size_t length, uint8_t* out, size_t capacity);
+    size_t decompress(const uint8_t* data, size_t length, uint8_t* out, size_t capacity);
+
+private:
+    QByteArray dictionary;
+    int threshold;
+    uint32_t dictionaryId;
+    z_stream deflater;
+    z_stream inflater;
+    bool deflaterReady = false;
+    bool inflaterReady = false;
+};
+
+}
+
+#endif // _QT_TOX_PACKET_CODEC_H_
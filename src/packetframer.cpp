@@ -0,0 +1,327 @@
+#include "packetframer.h"
+
+#include "common.h"
+#include "datahelper.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+const uint8_t FlagFirst = 0x01;
+// packet id, flags and message id
+const size_t HeaderSize = 4;
+// total payload length, sent with the first fragment only
+const size_t LengthSize = 4;
+// room for the trailer LowLevel adds on compressed packet ids
+const size_t FragmentSize = QtTox::MaxCustomPacketSize - 1;
+
+quint64 messageKey(uint32_t friendNum, uint16_t messageId)
+{
+    return (static_cast<quint64>(friendNum) << 32) | messageId;
+}
+
+uint32_t friendOf(quint64 key)
+{
+    return static_cast<uint32_t>(key >> 32);
+}
+
+uint16_t readU16(const uint8_t* data)
+{
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+uint32_t readU32(const uint8_t* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16)
+         | (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+void writeU16(uint8_t* data, uint16_t value)
+{
+    data[0] = static_cast<uint8_t>(value >> 8);
+    data[1] = static_cast<uint8_t>(value);
+}
+
+void writeU32(uint8_t* data, uint32_t value)
+{
+    data[0] = static_cast<uint8_t>(value >> 24);
+    data[1] = static_cast<uint8_t>(value >> 16);
+    data[2] = static_cast<uint8_t>(value >> 8);
+    data[3] = static_cast<uint8_t>(value);
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class PacketFramer
+ * @brief Sends payloads of any size over lossless custom packets.
+ *
+ * A payload is split into fragments that fill a custom packet each. The
+ * first fragment carries the total length, so the receiver allocates the
+ * final buffer once and copies every fragment straight into place. Lossless
+ * packets arrive in order, which makes explicit offsets unnecessary; the
+ * message id alone tells interleaved messages apart. Messages to one friend
+ * are sent round robin, one fragment each, so a small message never waits
+ * for a large one to finish.
+ */
+
+/**
+ * @param lowLevel Service used to send and receive custom packets.
+ * @param packetId First byte of all packets of this framer.
+ * @param maxPendingBytes Limit for partially received messages per friend,
+ * larger messages are dropped.
+ */
+PacketFramer::PacketFramer(LowLevel* lowLevel, uint8_t packetId, int maxPendingBytes)
+    : lowLevel{lowLevel}
+    , packetId{packetId}
+    , maxPendingBytes{maxPendingBytes}
+    , packet(static_cast<int>(MaxCustomPacketSize), Qt::Uninitialized)
+{
+    lowLevel->setPacketHandler(packetId, [this](uint32_t friendNum, const uint8_t* data,
+                                                size_t length) {
+        handlePacket(friendNum, data, length);
+    });
+}
+
+PacketFramer::~PacketFramer()
+{
+    lowLevel->setPacketHandler(packetId, nullptr);
+}
+
+/**
+ * @brief Queues a payload and sends as much of it as toxcore accepts.
+ * @return Message id reported in messageSent() and messageFailed().
+ */
+uint16_t PacketFramer::send(uint32_t friendNum, const QByteArray& payload)
+{
+    const auto messageId = nextMessageId[friendNum]++;
+    outgoing[friendNum].append(Outgoing{messageId, payload, -1});
+
+    auto results = QVector<Result>{};
+    flush(friendNum, results);
+    report(results);
+    return messageId;
+}
+
+/**
+ * @brief Message id the next send() to the friend returns.
+ */
+uint16_t PacketFramer::getNextMessageId(uint32_t friendNum) const
+{
+    return nextMessageId.value(friendNum);
+}
+
+/**
+ * @brief Sends queued fragments, call after each Core::iterate().
+ */
+void PacketFramer::iterate()
+{
+    auto results = QVector<Result>{};
+    for (const auto friendNum : outgoing.keys()) {
+        flush(friendNum, results);
+    }
+
+    report(results);
+}
+
+/**
+ * @brief Drops all messages from and to a friend, e.g. after it went offline.
+ */
+void PacketFramer::forgetFriend(uint32_t friendNum)
+{
+    outgoing.remove(friendNum);
+    pendingBytes.remove(friendNum);
+    for (auto it = incoming.begin(); it != incoming.end();) {
+        if (friendOf(it.key()) == friendNum) {
+            it = incoming.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * @brief Handles a lossless custom packet of the framer's packet id.
+ * @param data Packet including the packet id byte.
+ */
+void PacketFramer::handlePacket(uint32_t friendNum, const uint8_t* data, size_t length)
+{
+    if (length < HeaderSize || data[0] != packetId) {
+        return;
+    }
+
+    const auto first = (data[1] & FlagFirst) != 0;
+    const auto key = messageKey(friendNum, readU16(data + 2));
+    auto offset = HeaderSize;
+    auto it = incoming.find(key);
+    if (first) {
+        if (length < HeaderSize + LengthSize) {
+            ++dropped;
+            return;
+        }
+
+        if (it != incoming.end()) {
+            // the id wrapped around while the old message was incomplete
+            drop(friendNum, key);
+        }
+
+        const auto total = readU32(data + HeaderSize);
+        offset += LengthSize;
+        if (total == length - offset) {
+            // unfragmented messages skip the reassembly table
+            emit messageReceived(friendNum, bytes(data + offset, length - offset));
+            return;
+        }
+
+        auto& pending = pendingBytes[friendNum];
+        if (total < length - offset || pending + static_cast<qint64>(total) > maxPendingBytes) {
+            ++dropped;
+            return;
+        }
+
+        pending += total;
+        it = incoming.insert(key, Incoming{QByteArray(static_cast<int>(total), Qt::Uninitialized), 0});
+    } else if (it == incoming.end()) {
+        // the first fragment was dropped, so the rest is useless
+        return;
+    }
+
+    auto& message = *it;
+    const auto fragment = length - offset;
+    if (fragment > static_cast<size_t>(message.payload.size() - message.received)) {
+        drop(friendNum, key);
+        return;
+    }
+
+    memcpy(message.payload.data() + message.received, data + offset, fragment);
+    message.received += static_cast<int>(fragment);
+    if (message.received < message.payload.size()) {
+        return;
+    }
+
+    const auto payload = message.payload;
+    incoming.erase(it);
+    pendingBytes[friendNum] -= payload.size();
+    emit messageReceived(friendNum, payload);
+}
+
+/**
+ * @brief Number of messages not completely sent over all friends.
+ */
+int PacketFramer::getPendingCount() const
+{
+    auto count = 0;
+    for (const auto& messages : outgoing) {
+        count += messages.size();
+    }
+
+    return count;
+}
+
+/**
+ * @brief Number of received messages dropped as malformed or too large.
+ */
+uint64_t PacketFramer::getDroppedCount() const
+{
+    return dropped;
+}
+
+void PacketFramer::flush(uint32_t friendNum, QVector<Result>& results)
+{
+    auto it = outgoing.find(friendNum);
+    if (it == outgoing.end()) {
+        return;
+    }
+
+    auto& messages = *it;
+    auto err = LowLevel::ErrFriendCustomPacket::Ok;
+    auto index = 0;
+    while (!messages.isEmpty()) {
+        // one fragment per message and round, short messages finish early
+        index %= messages.size();
+        auto& message = messages[index];
+        if (!sendFragment(friendNum, message, &err)) {
+            break;
+        }
+
+        if (message.offset == message.payload.size()) {
+            results.append(Result{friendNum, message.messageId, err});
+            messages.removeAt(index);
+        } else {
+            ++index;
+        }
+    }
+
+    if (err != LowLevel::ErrFriendCustomPacket::Ok
+            && err != LowLevel::ErrFriendCustomPacket::Sendq) {
+        // nothing more gets through, e.g. the friend went offline
+        for (const auto& message : messages) {
+            results.append(Result{friendNum, message.messageId, err});
+        }
+
+        messages.clear();
+    }
+
+    if (messages.isEmpty()) {
+        outgoing.erase(it);
+    }
+}
+
+bool PacketFramer::sendFragment(uint32_t friendNum, Outgoing& message,
+        LowLevel::ErrFriendCustomPacket* err)
+{
+    auto out = data(packet);
+    out[0] = packetId;
+    writeU16(out + 2, message.messageId);
+    auto offset = HeaderSize;
+    const auto first = message.offset < 0;
+    if (first) {
+        out[1] = FlagFirst;
+        writeU32(out + HeaderSize, static_cast<uint32_t>(message.payload.size()));
+        offset += LengthSize;
+    } else {
+        out[1] = 0;
+    }
+
+    const auto start = first ? 0 : message.offset;
+    const auto fragment = std::min(static_cast<size_t>(message.payload.size() - start),
+                                   FragmentSize - offset);
+    memcpy(out + offset, message.payload.constData() + start, fragment);
+    const auto sent = lowLevel->friendSendLossLessPacket(friendNum, out, offset + fragment, err);
+    if (sent) {
+        message.offset = start + static_cast<int>(fragment);
+    }
+
+    return sent;
+}
+
+void PacketFramer::drop(uint32_t friendNum, quint64 key)
+{
+    auto it = incoming.find(key);
+    if (it == incoming.end()) {
+        return;
+    }
+
+    pendingBytes[friendNum] -= it->payload.size();
+    incoming.erase(it);
+    ++dropped;
+}
+
+void PacketFramer::report(const QVector<Result>& results)
+{
+    // emit only after the queues are consistent, receivers may send again
+    for (const auto& result : results) {
+        if (result.err == LowLevel::ErrFriendCustomPacket::Ok) {
+            emit messageSent(result.friendNum, result.messageId);
+        } else {
+            emit messageFailed(result.friendNum, result.messageId, result.err);
+        }
+    }
+}
+
+}
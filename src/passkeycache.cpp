@@ -0,0 +1,100 @@
+#include "passkeycache.h"
+
+#include <QCryptographicHash>
+#include <QMutexLocker>
+
+namespace
+{
+
+const int MaxEntries = 8;
+
+QByteArray digestOf(const QByteArray& salt, const QByteArray& pass)
+{
+    QCryptographicHash hash{QCryptographicHash::Sha256};
+    hash.addData(salt);
+    hash.addData(pass);
+    return hash.result();
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class PassKeyCache
+ * @brief Process wide cache of derived pass keys, keyed by salt and password.
+ *
+ * Deriving a pass key is deliberately slow, while a profile is loaded and
+ * saved many times with one password and one salt. Entries are looked up by
+ * a salted SHA-256 of the password, so neither the password nor an unsalted
+ * hash of it is kept. The cache holds a handful of entries, most recently
+ * used first, and may be used from any thread.
+ */
+
+PassKeyCache& PassKeyCache::instance()
+{
+    static PassKeyCache cache;
+    return cache;
+}
+
+/**
+ * @brief Looks up the key derived from the password and the salt.
+ */
+PassKeyCache::Key PassKeyCache::find(const QByteArray& pass, const QByteArray& salt)
+{
+    const auto digest = digestOf(salt, pass);
+    QMutexLocker locker{&mutex};
+    for (auto i = 0; i < entries.size(); ++i) {
+        if (entries[i].salt == salt && entries[i].digest == digest) {
+            entries.move(i, 0);
+            return entries.first().key;
+        }
+    }
+
+    return {};
+}
+
+/**
+ * @brief Looks up the most recent key derived from the password with any salt.
+ */
+PassKeyCache::Key PassKeyCache::findAny(const QByteArray& pass)
+{
+    QMutexLocker locker{&mutex};
+    for (auto i = 0; i < entries.size(); ++i) {
+        if (entries[i].digest == digestOf(entries[i].salt, pass)) {
+            entries.move(i, 0);
+            return entries.first().key;
+        }
+    }
+
+    return {};
+}
+
+void PassKeyCache::insert(const QByteArray& pass, const QByteArray& salt, const Key& key)
+{
+    const auto digest = digestOf(salt, pass);
+    QMutexLocker locker{&mutex};
+    for (auto i = 0; i < entries.size(); ++i) {
+        if (entries[i].salt == salt && entries[i].digest == digest) {
+            entries.removeAt(i);
+            break;
+        }
+    }
+
+    entries.prepend(Entry{salt, digest, key});
+    while (entries.size() > MaxEntries) {
+        entries.removeLast();
+    }
+}
+
+/**
+ * @brief Drops all keys, e.g. when the profile is closed.
+ */
+void PassKeyCache::clear()
+{
+    QMutexLocker locker{&mutex};
+    entries.clear();
+}
+
+}
@@ -0,0 +1,44 @@
+#ifndef _QT_TOX_PASS_KEY_CACHE_H_
+#define _QT_TOX_PASS_KEY_CACHE_H_
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+
+#include <memory>
+
+struct Tox_Pass_Key;
+
+namespace QtTox
+{
+
+class PassKeyCache
+{
+public:
+    using Key = std::shared_ptr<Tox_Pass_Key>;
+
+    static PassKeyCache& instance();
+
+    Key find(const QByteArray& pass, const QByteArray& salt);
+    Key findAny(const QByteArray& pass);
+    void insert(const QByteArray& pass, const QByteArray& salt, const Key& key);
+    void clear();
+
+private:
+    struct Entry
+    {
+        QByteArray salt;
+        QByteArray digest;
+        Key key;
+    };
+
+    PassKeyCache() = default;
+
+private:
+    QMutex mutex;
+    QList<Entry> entries;
+};
+
+}
+
+#endif // _QT_TOX_PASS_KEY_CACHE_H_
@@ -0,0 +1,149 @@
+#include "profileloader.h"
+
+#include "startupreport.h"
+#include "toxencrypt.h"
+
+namespace QtTox
+{
+
+/**
+ * @class ProfileLoader
+ * @brief Loads the savedata of a profile while the rest of startup runs.
+ *
+ * The profile is mapped instead of read. An unencrypted profile is handed
+ * out as a view of the mapping without a copy. An encrypted one is
+ * decrypted on a worker thread, the key comes from the key cache if it was
+ * derived before, so the caller can construct services meanwhile and only
+ * waits in takeSavedata().
+ */
+
+/**
+ * @param report Receives the timings of the loading phases, may be nullptr.
+ */
+ProfileLoader::ProfileLoader(StartupReport* report)
+    : report{report}
+{
+}
+
+/**
+ * @brief Waits for a running decryption before unmapping the profile.
+ */
+ProfileLoader::~ProfileLoader()
+{
+    if (decrypted.valid()) {
+        decrypted.wait();
+    }
+}
+
+/**
+ * @brief Maps the profile and starts decrypting it, once per loader.
+ * @param password Password of an encrypted profile, ignored otherwise.
+ */
+bool ProfileLoader::start(const QString& path, const QString& password, ErrLoad* err)
+{
+    // the savedata handed out may still point into the mapping
+    if (file.isOpen()) {
+        if (err) {
+            *err = ErrLoad::AlreadyStarted;
+        }
+
+        return false;
+    }
+
+    const auto mapStart = report ? report->now() : 0;
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (err) {
+            *err = ErrLoad::OpenFailed;
+        }
+
+        return false;
+    }
+
+    if (file.size() == 0) {
+        if (err) {
+            *err = ErrLoad::Empty;
+        }
+
+        return false;
+    }
+
+    mapped = file.map(0, file.size());
+    if (!mapped) {
+        if (err) {
+            *err = ErrLoad::MapFailed;
+        }
+
+        return false;
+    }
+
+    const auto view = QByteArray::fromRawData(reinterpret_cast<const char*>(mapped),
+                                              static_cast<int>(file.size()));
+    encrypted = ToxEncrypt::isEncrypted(view);
+    if (report) {
+        report->record(QStringLiteral("map savedata"), mapStart);
+    }
+
+    if (encrypted) {
+        const auto report = this->report;
+        decrypted = std::async(std::launch::async, [view, password, report]() {
+            const auto keyStart = report ? report->now() : 0;
+            const auto encrypt = ToxEncrypt::makeToxEncrypt(password, view);
+            if (report) {
+                report->record(QStringLiteral("derive key"), keyStart);
+            }
+
+            if (!encrypt) {
+                return QByteArray{};
+            }
+
+            const auto decryptStart = report ? report->now() : 0;
+            const auto savedata = encrypt->decrypt(view);
+            if (report) {
+                report->record(QStringLiteral("decrypt savedata"), decryptStart);
+            }
+
+            return savedata;
+        });
+    }
+
+    if (err) {
+        *err = ErrLoad::Ok;
+    }
+
+    return true;
+}
+
+bool ProfileLoader::isEncrypted() const
+{
+    return encrypted;
+}
+
+/**
+ * @brief Waits for the savedata.
+ * @return The savedata, empty on failure. Unencrypted savedata refers to the
+ * mapped file and stays valid only as long as the loader.
+ */
+QByteArray ProfileLoader::takeSavedata(ErrLoad* err)
+{
+    auto savedata = QByteArray{};
+    if (decrypted.valid()) {
+        const auto waitStart = report ? report->now() : 0;
+        savedata = decrypted.get();
+        if (report) {
+            report->record(QStringLiteral("wait for savedata"), waitStart);
+        }
+    } else if (mapped) {
+        savedata = QByteArray::fromRawData(reinterpret_cast<const char*>(mapped),
+                                           static_cast<int>(file.size()));
+    }
+
+    if (err) {
+        *err = savedata.isEmpty() ? (encrypted ? ErrLoad::Decrypt : ErrLoad::OpenFailed)
+                                  : ErrLoad::Ok;
+    }
+
+    return savedata;
+}
+
+}
@@ -0,0 +1,204 @@
+#include "realtimechannel.h"
+
+#include "common.h"
+#include "datahelper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+
+// packet id, sequence number and send time
+const size_t HeaderSize = 9;
+// weight of a new sample in the rolling averages
+const double Gain = 1.0 / 16;
+// longer gaps are a restarted sender rather than loss
+const int64_t MaxGap = 1 << 16;
+// missing sequences this close to the newest are remembered to spot reordering
+const int64_t ReorderWindow = 256;
+
+void writeU32(uint8_t* data, uint32_t value)
+{
+    data[0] = static_cast<uint8_t>(value >> 24);
+    data[1] = static_cast<uint8_t>(value >> 16);
+    data[2] = static_cast<uint8_t>(value >> 8);
+    data[3] = static_cast<uint8_t>(value);
+}
+
+uint32_t readU32(const uint8_t* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16)
+         | (static_cast<uint32_t>(data[2]) << 8) | data[3];
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class RealtimeChannel
+ * @brief Lossy channel with sequence numbers and link quality statistics.
+ *
+ * Every packet carries a sequence number and the sender's clock in
+ * milliseconds. The receiver only delivers packets newer than the newest
+ * one seen, so consumers never get stale data. Gaps in the sequence count
+ * as loss, packets arriving after a newer one count as late. A missing
+ * packet that arrives late within the last 256 sequences was reordered, its
+ * loss is taken back. Jitter is the
+ * smoothed variation of the transit time as in RFC 3550, which needs no
+ * synchronized clocks. All statistics are updated in constant time per
+ * packet and read with a single hash lookup.
+ */
+
+/**
+ * @param lowLevel Service used to send and receive custom packets.
+ * @param packetId Custom packet id of the channel, must match on both sides.
+ */
+RealtimeChannel::RealtimeChannel(LowLevel* lowLevel, uint8_t packetId)
+    : lowLevel{lowLevel}
+    , packetId{packetId}
+    , packet(static_cast<int>(MaxCustomPacketSize), Qt::Uninitialized)
+{
+    clock.start();
+    lowLevel->setPacketHandler(packetId, [this](uint32_t friendNum, const uint8_t* data,
+                                                size_t length) {
+        handlePacket(friendNum, data, length);
+    });
+}
+
+RealtimeChannel::~RealtimeChannel()
+{
+    lowLevel->setPacketHandler(packetId, nullptr);
+}
+
+/**
+ * @brief Sends a payload stamped with the next sequence number.
+ */
+bool RealtimeChannel::send(uint32_t friendNum, const QByteArray& payload,
+        LowLevel::ErrFriendCustomPacket* err)
+{
+    const auto length = HeaderSize + size(payload);
+    if (length > MaxCustomPacketSize) {
+        if (err) {
+            *err = LowLevel::ErrFriendCustomPacket::TooLong;
+        }
+
+        return false;
+    }
+
+    auto out = data(packet);
+    out[0] = packetId;
+    writeU32(out + 1, nextSequence[friendNum]++);
+    writeU32(out + 5, static_cast<uint32_t>(clock.elapsed()));
+    memcpy(out + HeaderSize, payload.constData(), size(payload));
+    return lowLevel->friendSendLossyPacket(friendNum, out, length, err);
+}
+
+/**
+ * @brief Sets the receiver of in-order packets.
+ */
+void RealtimeChannel::setHandler(Handler handler)
+{
+    this->handler = std::move(handler);
+}
+
+/**
+ * @brief Current link statistics of packets received from the friend.
+ */
+RealtimeChannel::LinkQuality RealtimeChannel::getLinkQuality(uint32_t friendNum) const
+{
+    return peers.value(friendNum).quality;
+}
+
+/**
+ * @brief Resets the statistics and sequence numbers of a friend.
+ */
+void RealtimeChannel::forgetFriend(uint32_t friendNum)
+{
+    peers.remove(friendNum);
+    nextSequence.remove(friendNum);
+}
+
+void RealtimeChannel::handlePacket(uint32_t friendNum, const uint8_t* data, size_t length)
+{
+    if (length < HeaderSize) {
+        return;
+    }
+
+    const auto sequence = readU32(data + 1);
+    const auto sentAt = readU32(data + 5);
+    const auto now = clock.elapsed();
+
+    auto it = peers.find(friendNum);
+    if (it == peers.end()) {
+        auto peer = Peer{};
+        peer.lastSequence = sequence - 1;
+        peer.lastTransit = now - static_cast<qint64>(sentAt);
+        peer.lastSentAt = sentAt;
+        peer.senderTime = static_cast<qint64>(sentAt);
+        it = peers.insert(friendNum, peer);
+    }
+
+    auto& peer = *it;
+    auto& quality = peer.quality;
+    const auto gap = static_cast<int64_t>(static_cast<int32_t>(sequence - peer.lastSequence));
+    if (gap <= 0 && gap > -MaxGap) {
+        ++quality.late;
+        quality.lateRate += Gain * (1 - quality.lateRate);
+        const auto age = -gap;
+        if (age > 0 && age < ReorderWindow && peer.missing[static_cast<size_t>(age)]) {
+            // counted as lost when the gap opened, roughly undo that sample
+            peer.missing[static_cast<size_t>(age)] = false;
+            --quality.lost;
+            ++quality.reordered;
+            quality.lossRate = std::max(0.0,
+                    quality.lossRate - Gain * std::pow(1 - Gain, static_cast<double>(age)));
+        }
+
+        return;
+    }
+
+    if (gap > 0 && gap < MaxGap) {
+        // every missing packet is a loss sample, followed by one success
+        const auto missing = gap - 1;
+        quality.lost += static_cast<uint64_t>(missing);
+        quality.lossRate = 1 - (1 - quality.lossRate) * std::pow(1 - Gain, missing);
+        if (gap < ReorderWindow) {
+            peer.missing <<= static_cast<size_t>(gap);
+            for (auto age = int64_t{1}; age < gap; ++age) {
+                peer.missing[static_cast<size_t>(age)] = true;
+            }
+        } else {
+            peer.missing.reset();
+        }
+    } else {
+        // a restarted sender, its clock restarted too
+        peer.missing.reset();
+        peer.lastSentAt = sentAt;
+        peer.senderTime = static_cast<qint64>(sentAt);
+        peer.lastTransit = now - peer.senderTime;
+    }
+
+    quality.lossRate *= 1 - Gain;
+    quality.lateRate *= 1 - Gain;
+    ++quality.received;
+
+    // only differences matter, the clocks don't need to agree, but the
+    // sender's 32 bit clock wraps after 49 days
+    peer.senderTime += static_cast<int32_t>(sentAt - peer.lastSentAt);
+    peer.lastSentAt = sentAt;
+    const auto transit = now - peer.senderTime;
+    const auto delta = static_cast<double>(transit - peer.lastTransit);
+    quality.jitterMs += Gain * (std::abs(delta) - quality.jitterMs);
+    peer.lastSequence = sequence;
+    peer.lastTransit = transit;
+
+    if (handler) {
+        handler(friendNum, sequence, data + HeaderSize, length - HeaderSize);
+    }
+}
+
+}
@@ -0,0 +1,217 @@
+#include "relaypool.h"
+
+#include "chatlist.h"
+#include "core.h"
+#include "messenger.h"
+#include "self.h"
+
+#include <algorithm>
+
+namespace
+{
+
+const int MinCheckIntervalMs = 1000;
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class RelayPool
+ * @brief Keeps a few TCP relays active and replaces those that seem dead.
+ *
+ * Relays are added to toxcore a few at a time from a larger pool. toxcore
+ * doesn't report the state of single relays, so health is judged from the
+ * connection states: once the instance has been offline for the dead period
+ * while relays were active, the active relay with the most strikes is
+ * rotated out and the healthiest unused relay is added instead, at most one
+ * rotation per dead period. toxcore can't drop a relay, a rotated out relay
+ * only stops counting as active. Friend connection changes between TCP, UDP
+ * and none are counted to show how much traffic depends on relays.
+ */
+
+/**
+ * @param core Instance the relays are added to, has to outlive the pool.
+ * @param activeCount Number of relays kept active.
+ * @param deadAfterMs Time offline after which an active relay is rotated out.
+ */
+RelayPool::RelayPool(Core* core, int activeCount, int deadAfterMs)
+    : core{core}
+    , activeCount{std::max(activeCount, 1)}
+    , deadAfter{deadAfterMs}
+{
+    connect(core->getSelf(), &Self::selfConnectionStatusChanged,
+            this, &RelayPool::onSelfConnectionChanged);
+    connect(core->getMessenger(), &Messenger::friendConnectionStatusChanged,
+            this, &RelayPool::onFriendConnectionChanged);
+    // ChatList has no signal for deleted friends, but deleting changes the savedata
+    connect(core->getChatList(), &ChatList::savedataChanged,
+            this, &RelayPool::pruneFriends);
+    connect(&timer, &QTimer::timeout, this, &RelayPool::check);
+    offlineSince.start();
+    timer.start(std::max(deadAfter / 4, MinCheckIntervalMs));
+}
+
+/**
+ * @brief Adds a relay to the pool, it becomes active if fewer than the
+ * configured number of relays are active.
+ */
+void RelayPool::addRelay(const Relay& relay)
+{
+    for (const auto& known : relays) {
+        if (known.relay.publicKey == relay.publicKey && known.relay.address == relay.address
+                && known.relay.port == relay.port) {
+            return;
+        }
+    }
+
+    relays.append(RelayHealth{relay, false, 0, 0});
+    fill();
+}
+
+RelayPool::Health RelayPool::getHealth() const
+{
+    auto health = Health{self, 0, 0, 0, 0, tcpDrops, tcpToUdp, rotations};
+    for (const auto& relay : relays) {
+        health.activeRelays += relay.active ? 1 : 0;
+    }
+
+    for (const auto status : friends) {
+        switch (status) {
+        case Connection::UDP:
+            ++health.friendsUdp;
+            break;
+        case Connection::TCP:
+            ++health.friendsTcp;
+            break;
+        case Connection::None:
+            ++health.friendsOffline;
+            break;
+        }
+    }
+
+    return health;
+}
+
+QVector<RelayPool::RelayHealth> RelayPool::getRelays() const
+{
+    return relays;
+}
+
+void RelayPool::fill()
+{
+    auto active = 0;
+    for (const auto& relay : relays) {
+        active += relay.active ? 1 : 0;
+    }
+
+    while (active < activeCount && activateNext() >= 0) {
+        ++active;
+    }
+}
+
+/**
+ * @brief Activates the inactive relay with the fewest strikes.
+ * @return Index of the activated relay, -1 if all relays are active.
+ */
+int RelayPool::activateNext()
+{
+    auto best = -1;
+    for (auto i = 0; i < relays.size(); ++i) {
+        if (!relays[i].active && (best < 0 || relays[i].strikes < relays[best].strikes)) {
+            best = i;
+        }
+    }
+
+    if (best < 0) {
+        return -1;
+    }
+
+    auto& relay = relays[best];
+    relay.active = true;
+    core->addTcpReleay(relay.relay.address, relay.relay.port, relay.relay.publicKey);
+    return best;
+}
+
+void RelayPool::check()
+{
+    if (self != Connection::None || offlineSince.elapsed() < deadAfter) {
+        return;
+    }
+
+    if (lastRotation.isValid() && lastRotation.elapsed() < deadAfter) {
+        return;
+    }
+
+    rotate();
+}
+
+void RelayPool::rotate()
+{
+    auto worst = -1;
+    for (auto i = 0; i < relays.size(); ++i) {
+        if (relays[i].active && (worst < 0 || relays[i].strikes > relays[worst].strikes)) {
+            worst = i;
+        }
+    }
+
+    if (worst < 0) {
+        return;
+    }
+
+    // the replacement has to be chosen while the dead relay is still active
+    const auto replacement = activateNext();
+    if (replacement < 0) {
+        // nothing to rotate in, the dead relay stays active
+        return;
+    }
+
+    ++relays[worst].strikes;
+    relays[worst].active = false;
+    ++rotations;
+    lastRotation.start();
+    emit relayRotated(relays[worst].relay, relays[replacement].relay);
+}
+
+void RelayPool::onSelfConnectionChanged(Connection status)
+{
+    if (status == Connection::None && self != Connection::None) {
+        offlineSince.start();
+    } else if (status == Connection::TCP) {
+        for (auto& relay : relays) {
+            if (relay.active) {
+                ++relay.successes;
+                relay.strikes = 0;
+            }
+        }
+    }
+
+    self = status;
+}
+
+void RelayPool::onFriendConnectionChanged(uint32_t friendNum, Connection status)
+{
+    const auto previous = friends.value(friendNum, Connection::None);
+    if (previous == Connection::TCP && status == Connection::None) {
+        ++tcpDrops;
+    } else if (previous == Connection::TCP && status == Connection::UDP) {
+        ++tcpToUdp;
+    }
+
+    friends.insert(friendNum, status);
+}
+
+void RelayPool::pruneFriends()
+{
+    const auto chatList = core->getChatList();
+    for (auto it = friends.begin(); it != friends.end();) {
+        if (chatList->friendExists(it.key())) {
+            ++it;
+        } else {
+            it = friends.erase(it);
+        }
+    }
+}
+
+}
@@ -0,0 +1,260 @@
+#include "rpcchannel.h"
+
+#include "datahelper.h"
+
+namespace
+{
+
+enum Kind : uint8_t
+{
+    Request = 0,
+    Response = 1,
+    NoMethod = 2,
+};
+
+// kind and request id, requests add the method
+const int ResponseHeaderSize = 5;
+const int RequestHeaderSize = 7;
+
+quint64 makeKey(uint32_t friendNum, uint32_t id)
+{
+    return (static_cast<quint64>(friendNum) << 32) | id;
+}
+
+uint32_t keyFriend(quint64 key)
+{
+    return static_cast<uint32_t>(key >> 32);
+}
+
+void appendU16(QByteArray& out, uint16_t value)
+{
+    out.append(static_cast<char>(value >> 8));
+    out.append(static_cast<char>(value));
+}
+
+void appendU32(QByteArray& out, uint32_t value)
+{
+    appendU16(out, static_cast<uint16_t>(value >> 16));
+    appendU16(out, static_cast<uint16_t>(value));
+}
+
+uint16_t readU16(const uint8_t* data)
+{
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+uint32_t readU32(const uint8_t* data)
+{
+    return (static_cast<uint32_t>(readU16(data)) << 16) | readU16(data + 2);
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class RpcChannel
+ * @brief Request/response calls to friends over framed lossless packets.
+ *
+ * Every call gets a request id unique per friend, the response is matched
+ * by a hash lookup on friend and id. Any number of calls may be
+ * outstanding, the framer interleaves their messages. All calls share one
+ * timeout, so deadlines expire in call order and iterate() only looks at
+ * the expired ones. Callbacks run exactly once: with the response, or with
+ * the reason the call failed.
+ */
+
+/**
+ * @param lowLevel Service used to send and receive custom packets.
+ * @param packetId Custom packet id of the channel, must match on both sides.
+ * @param timeoutMs Time a call waits for its response.
+ */
+RpcChannel::RpcChannel(LowLevel* lowLevel, uint8_t packetId, int timeoutMs)
+    : framer{new PacketFramer{lowLevel, packetId}}
+    , timeout{timeoutMs}
+{
+    clock.start();
+    connect(framer.get(), &PacketFramer::messageReceived, this, &RpcChannel::handleMessage);
+    connect(framer.get(), &PacketFramer::messageSent, this,
+            [this](uint32_t friendNum, uint16_t messageId) {
+        requestOfMessage.remove(makeKey(friendNum, messageId));
+    });
+    connect(framer.get(), &PacketFramer::messageFailed, this,
+            [this](uint32_t friendNum, uint16_t messageId) {
+        handleFailure(friendNum, messageId);
+    });
+}
+
+RpcChannel::~RpcChannel() = default;
+
+/**
+ * @brief Calls a method on the friend.
+ * @param callback Called with the response or the error. If the friend
+ * can't be reached at all, it is called before call() returns.
+ * @return Request id of the call.
+ */
+uint32_t RpcChannel::call(uint32_t friendNum, uint16_t method, const QByteArray& request,
+        Callback callback)
+{
+    const auto requestId = nextRequestId[friendNum]++;
+    const auto key = makeKey(friendNum, requestId);
+    const auto deadline = clock.elapsed() + timeout;
+    pending.insert(key, Pending{std::move(callback), deadline});
+    deadlines.enqueue(Deadline{deadline, key});
+
+    auto message = QByteArray{};
+    message.reserve(RequestHeaderSize + request.size());
+    message.append(static_cast<char>(Kind::Request));
+    appendU32(message, requestId);
+    appendU16(message, method);
+    message.append(request);
+
+    // map the message before sending, a failure may be reported right away
+    requestOfMessage.insert(makeKey(friendNum, framer->getNextMessageId(friendNum)), key);
+    framer->send(friendNum, message);
+    return requestId;
+}
+
+/**
+ * @brief Answers a request passed to a method handler.
+ */
+void RpcChannel::respond(uint32_t friendNum, uint32_t requestId, const QByteArray& response)
+{
+    reply(friendNum, requestId, Kind::Response, response);
+}
+
+/**
+ * @brief Sets the handler of a method, an empty handler removes it.
+ *
+ * The handler answers with respond(), either right away or later.
+ */
+void RpcChannel::setMethodHandler(uint16_t method, Handler handler)
+{
+    if (handler) {
+        handlers.insert(method, std::move(handler));
+    } else {
+        handlers.remove(method);
+    }
+}
+
+/**
+ * @brief Sends queued messages and expires calls, call after each Core::iterate().
+ */
+void RpcChannel::iterate()
+{
+    framer->iterate();
+
+    const auto now = clock.elapsed();
+    while (!deadlines.isEmpty() && deadlines.head().deadline <= now) {
+        const auto key = deadlines.dequeue().key;
+        // calls that finished already are skipped here
+        finish(key, ErrCall::Timeout, {});
+    }
+}
+
+/**
+ * @brief Fails all calls to the friend, e.g. after it went offline.
+ */
+void RpcChannel::forgetFriend(uint32_t friendNum)
+{
+    framer->forgetFriend(friendNum);
+
+    auto keys = QVector<quint64>{};
+    for (auto it = pending.cbegin(); it != pending.cend(); ++it) {
+        if (keyFriend(it.key()) == friendNum) {
+            keys.append(it.key());
+        }
+    }
+
+    for (auto it = requestOfMessage.begin(); it != requestOfMessage.end();) {
+        if (keyFriend(it.key()) == friendNum) {
+            it = requestOfMessage.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (const auto key : keys) {
+        finish(key, ErrCall::Disconnected, {});
+    }
+}
+
+/**
+ * @brief Number of calls waiting for a response.
+ */
+int RpcChannel::getPendingCount() const
+{
+    return pending.size();
+}
+
+void RpcChannel::handleMessage(uint32_t friendNum, const QByteArray& message)
+{
+    if (message.size() < ResponseHeaderSize) {
+        return;
+    }
+
+    const auto header = data(message);
+    const auto requestId = readU32(header + 1);
+    switch (header[0]) {
+    case Kind::Request: {
+        if (message.size() < RequestHeaderSize) {
+            return;
+        }
+
+        const auto handler = handlers.value(readU16(header + 5));
+        if (!handler) {
+            reply(friendNum, requestId, Kind::NoMethod, {});
+            return;
+        }
+
+        handler(friendNum, requestId, message.mid(RequestHeaderSize));
+        return;
+    }
+    case Kind::Response:
+        finish(makeKey(friendNum, requestId), ErrCall::Ok, message.mid(ResponseHeaderSize));
+        return;
+    case Kind::NoMethod:
+        finish(makeKey(friendNum, requestId), ErrCall::NoMethod, {});
+        return;
+    }
+}
+
+void RpcChannel::handleFailure(uint32_t friendNum, uint16_t messageId)
+{
+    auto it = requestOfMessage.find(makeKey(friendNum, messageId));
+    if (it == requestOfMessage.end()) {
+        return;
+    }
+
+    const auto key = *it;
+    requestOfMessage.erase(it);
+    finish(key, ErrCall::SendFailed, {});
+}
+
+void RpcChannel::finish(quint64 key, ErrCall err, const QByteArray& response)
+{
+    auto it = pending.find(key);
+    if (it == pending.end()) {
+        return;
+    }
+
+    const auto callback = std::move(it->callback);
+    pending.erase(it);
+    if (callback) {
+        callback(err, response);
+    }
+}
+
+void RpcChannel::reply(uint32_t friendNum, uint32_t requestId, uint8_t kind,
+        const QByteArray& response)
+{
+    auto message = QByteArray{};
+    message.reserve(ResponseHeaderSize + response.size());
+    message.append(static_cast<char>(kind));
+    appendU32(message, requestId);
+    message.append(response);
+    framer->send(friendNum, message);
+}
+
+}
@@ -0,0 +1,196 @@
+#include "savemanager.h"
+
+#include "datahelper.h"
+#include "toxencrypt.h"
+
+#include <QRunnable>
+#include <QSaveFile>
+
+#include <algorithm>
+#include <functional>
+
+#include <tox/tox.h>
+
+namespace
+{
+
+// continuous changes still get saved at least this many debounce periods apart
+const int MaxDelayFactor = 5;
+
+class SaveJob : public QRunnable
+{
+public:
+    SaveJob(std::function<void()> work)
+        : work{std::move(work)}
+    {
+    }
+
+    void run() override
+    {
+        work();
+    }
+
+private:
+    std::function<void()> work;
+};
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class SaveManager
+ * @brief Saves the profile in the background after it changed.
+ *
+ * Changes only mark the profile dirty. The save follows once no change
+ * happened for the debounce period, or at the latest after five periods,
+ * so a burst of changes costs one save. The savedata is copied out of
+ * toxcore on the calling thread, toxcore isn't thread safe, and encrypted
+ * and written on a worker thread. Writes go to a temporary file that
+ * replaces the profile only once complete, so a crash never leaves a
+ * truncated profile. One save runs at a time, changes made meanwhile are
+ * saved after it. A failed save leaves the profile dirty and is retried
+ * after the debounce period.
+ */
+
+/**
+ * @param tox Instance whose savedata is saved.
+ * @param path File the profile is saved to.
+ * @param debounceMs Quiet time after the last change before saving.
+ */
+SaveManager::SaveManager(struct Tox* tox, const QString& path, int debounceMs)
+    : tox{tox}
+    , path{path}
+    , debounce{debounceMs}
+{
+    pool.setMaxThreadCount(1);
+    timer.setSingleShot(true);
+    connect(&timer, &QTimer::timeout, this, &SaveManager::save);
+    connect(this, &SaveManager::saved, this, &SaveManager::finishSave, Qt::QueuedConnection);
+}
+
+/**
+ * @brief Saves pending changes before destruction.
+ */
+SaveManager::~SaveManager()
+{
+    flush();
+}
+
+/**
+ * @brief Encrypts saves with an already derived key, nullptr saves unencrypted.
+ */
+void SaveManager::setToxEncrypt(std::unique_ptr<ToxEncrypt> encrypt)
+{
+    this->encrypt = std::move(encrypt);
+}
+
+/**
+ * @brief Schedules a save of the profile.
+ */
+void SaveManager::markDirty()
+{
+    if (!dirty) {
+        dirty = true;
+        dirtySince.start();
+    }
+
+    const auto maxDelay = static_cast<qint64>(debounce) * MaxDelayFactor;
+    const auto remaining = std::max<qint64>(maxDelay - dirtySince.elapsed(), 0);
+    timer.start(static_cast<int>(std::min<qint64>(debounce, remaining)));
+}
+
+/**
+ * @brief Checks for changes not yet handed to a save.
+ */
+bool SaveManager::isDirty() const
+{
+    return dirty;
+}
+
+/**
+ * @brief Saves pending changes on the calling thread, e.g. before exit.
+ * @return False if a pending change couldn't be saved.
+ */
+bool SaveManager::flush()
+{
+    timer.stop();
+    pool.waitForDone();
+    // a failed background save leaves its changes unsaved
+    if (failed.loadAcquire()) {
+        dirty = true;
+    }
+
+    if (!dirty) {
+        return true;
+    }
+
+    const auto success = write(path, savedata(), encrypt);
+    dirty = !success;
+    failed.storeRelease(success ? 0 : 1);
+    return success;
+}
+
+void SaveManager::save()
+{
+    if (writing.loadAcquire()) {
+        // finishSave() starts another save once the running one is done
+        return;
+    }
+
+    dirty = false;
+    writing.storeRelease(1);
+    const auto data = savedata();
+    const auto key = encrypt;
+    pool.start(new SaveJob{[this, data, key]() {
+        const auto success = write(path, data, key);
+        failed.storeRelease(success ? 0 : 1);
+        writing.storeRelease(0);
+        emit saved(success);
+    }});
+}
+
+void SaveManager::finishSave()
+{
+    // retry a failed save after the debounce period, flush() may have saved meanwhile
+    if (failed.loadAcquire()) {
+        markDirty();
+        return;
+    }
+
+    if (dirty && !timer.isActive()) {
+        save();
+    }
+}
+
+QByteArray SaveManager::savedata() const
+{
+    auto data = QByteArray{};
+    data.resize(static_cast<int>(tox_get_savedata_size(tox)));
+    tox_get_savedata(tox, ::data(data));
+    return data;
+}
+
+bool SaveManager::write(const QString& path, const QByteArray& savedata,
+        const std::shared_ptr<const ToxEncrypt>& encrypt)
+{
+    const auto data = encrypt ? encrypt->encrypt(savedata) : savedata;
+    if (data.isEmpty()) {
+        return false;
+    }
+
+    QSaveFile file{path};
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    if (file.write(data) != data.size()) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+}
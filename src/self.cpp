@@ -0,0 +1,173 @@
+#include "self.h"
+
+#include "datahelper.h"
+#include "fillerror.h"
+#include "services.h"
+#include "toxstring.h"
+
+#include <QMap>
+
+#include <tox/tox.h>
+
+namespace
+{
+
+template<class ToxErr, class Err>
+void fillErrSetInfo(ToxErr toxErr, Err* err)
+{
+#define ERR(toxName, qtName) \
+    { TOX_ERR_SET_INFO_##toxName, QtTox::Self::ErrSetInfo::qtName }
+    fillError(toxErr, err, {
+        ERR(OK,       Ok),
+        ERR(NULL,     Null),
+        ERR(TOO_LONG, TooLong),
+    });
+#undef ERR
+}
+
+QtTox::Connection toConnection(TOX_CONNECTION toxStatus)
+{
+    const auto map = QMap<TOX_CONNECTION, QtTox::Connection> {
+        { TOX_CONNECTION_NONE, QtTox::Connection::None },
+        { TOX_CONNECTION_TCP,  QtTox::Connection::TCP },
+        { TOX_CONNECTION_UDP,  QtTox::Connection::UDP },
+    };
+    return map[toxStatus];
+}
+
+void onSelfConnectionStatus(struct Tox* tox, TOX_CONNECTION toxStatus, void* payload)
+{
+    auto service = static_cast<QtTox::Services*>(payload);
+    emit service->self->selfConnectionStatusChanged(toConnection(toxStatus));
+}
+
+}
+
+namespace QtTox
+{
+
+Self::Self(struct Tox* tox)
+{
+    tox_callback_self_connection_status(tox, onSelfConnectionStatus);
+    this->tox = tox;
+}
+
+Connection Self::getSelfConnectionStatus() const
+{
+    return toConnection(tox_self_get_connection_status(tox));
+}
+
+QByteArray Self::getSelfAddress() const
+{
+    auto address = QByteArray{};
+    address.resize(TOX_ADDRESS_SIZE);
+    tox_self_get_address(tox, data(address));
+    return address;
+}
+
+QByteArray Self::getNospam() const
+{
+    auto nospam = QByteArray{};
+    nospam.resize(TOX_NOSPAM_SIZE);
+    const auto value = tox_self_get_nospam(tox);
+    // the same byte order as in the address
+    for (auto i = 0; i < TOX_NOSPAM_SIZE; ++i) {
+        nospam[i] = static_cast<char>(value >> (8 * (TOX_NOSPAM_SIZE - 1 - i)));
+    }
+
+    return nospam;
+}
+
+void Self::setNospam(const QByteArray& nospam)
+{
+    auto value = uint32_t{0};
+    for (auto i = 0; i < TOX_NOSPAM_SIZE && i < nospam.size(); ++i) {
+        value = (value << 8) | static_cast<uint8_t>(nospam[i]);
+    }
+
+    tox_self_set_nospam(tox, value);
+    emit savedataChanged();
+}
+
+QByteArray Self::getSelfPublicKey() const
+{
+    auto pk = QByteArray{};
+    pk.resize(TOX_PUBLIC_KEY_SIZE);
+    tox_self_get_public_key(tox, data(pk));
+    return pk;
+}
+
+QByteArray Self::getSelfSecretKey() const
+{
+    auto sk = QByteArray{};
+    sk.resize(TOX_SECRET_KEY_SIZE);
+    tox_self_get_secret_key(tox, data(sk));
+    return sk;
+}
+
+bool Self::setSelfName(const QString& name, ErrSetInfo* err)
+{
+    TOX_ERR_SET_INFO toxErr;
+    const auto cName = ToxString{name};
+    const auto success = tox_self_set_name(tox, cName.data(), cName.size(), &toxErr);
+    fillErrSetInfo(toxErr, err);
+    if (success) {
+        emit savedataChanged();
+    }
+
+    return success;
+}
+
+QString Self::getSelfName() const
+{
+    auto cName = QByteArray{};
+    cName.resize(tox_self_get_name_size(tox));
+    tox_self_get_name(tox, data(cName));
+    return ToxString(cName).getQString();
+}
+
+bool Self::setSelfStatusMessage(const QString& statusMessage, ErrSetInfo* err)
+{
+    TOX_ERR_SET_INFO toxErr;
+    const auto cMessage = ToxString{statusMessage};
+    const auto success = tox_self_set_status_message(tox, cMessage.data(), cMessage.size(),
+            &toxErr);
+    fillErrSetInfo(toxErr, err);
+    if (success) {
+        emit savedataChanged();
+    }
+
+    return success;
+}
+
+QString Self::getSelfStatusMessage() const
+{
+    auto cMessage = QByteArray{};
+    cMessage.resize(tox_self_get_status_message_size(tox));
+    tox_self_get_status_message(tox, data(cMessage));
+    return ToxString(cMessage).getQString();
+}
+
+bool Self::setSelfStatus(UserStatus status)
+{
+    const auto map = QMap<UserStatus, TOX_USER_STATUS> {
+        { UserStatus::None, TOX_USER_STATUS_NONE },
+        { UserStatus::Away, TOX_USER_STATUS_AWAY },
+        { UserStatus::Busy, TOX_USER_STATUS_BUSY },
+    };
+    tox_self_set_status(tox, map[status]);
+    emit savedataChanged();
+    return true;
+}
+
+UserStatus Self::getSelfStatus() const
+{
+    const auto map = QMap<TOX_USER_STATUS, UserStatus> {
+        { TOX_USER_STATUS_NONE, UserStatus::None },
+        { TOX_USER_STATUS_AWAY, UserStatus::Away },
+        { TOX_USER_STATUS_BUSY, UserStatus::Busy },
+    };
+    return map[tox_self_get_status(tox)];
+}
+
+}
@@ -0,0 +1,166 @@
+#include "sendqcontrol.h"
+
+#include "transferkey.h"
+
+#include <algorithm>
+
+namespace
+{
+
+const int MinBudget = 1;
+const int MaxBudget = 256;
+const int BudgetStep = 4;
+const int MaxBackoff = 32;
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class SendqControl
+ * @brief Resends file chunks toxcore rejected because its send queue was full.
+ *
+ * toxcore requests every chunk only once and accepts chunks of a transfer
+ * only in order, so a rejected chunk is queued and every later chunk of
+ * the same transfer queues behind it. The queues are retried from
+ * iterate(). Each friend has a budget of chunks per iteration that grows
+ * additively while retries succeed and halves on every reject. After a
+ * reject the friend is skipped for an exponentially growing number of
+ * iterations, which keeps the link full without spinning on a full queue.
+ */
+
+/**
+ * @brief Checks whether chunks of the transfer wait for a resend.
+ */
+bool SendqControl::isBlocked(quint64 key) const
+{
+    return pending.contains(key);
+}
+
+/**
+ * @brief Queues a chunk behind the waiting chunks of its transfer.
+ */
+void SendqControl::defer(quint64 key, const SendqChunk& chunk)
+{
+    auto& queue = pending[key];
+    if (queue.isEmpty()) {
+        friends[transferFriend(key)].transfers.append(key);
+    }
+
+    queue.enqueue(chunk);
+}
+
+/**
+ * @brief Records that toxcore rejected a chunk for the friend.
+ */
+void SendqControl::rejected(uint32_t friendNum)
+{
+    backOff(friends[friendNum]);
+}
+
+/**
+ * @brief Drops the waiting chunks of a finished or canceled transfer.
+ */
+void SendqControl::forget(quint64 key)
+{
+    if (!pending.remove(key)) {
+        return;
+    }
+
+    const auto friendNum = transferFriend(key);
+    auto it = friends.find(friendNum);
+    if (it == friends.end()) {
+        return;
+    }
+
+    it->transfers.removeOne(key);
+}
+
+/**
+ * @brief Resends waiting chunks within the budget of each friend.
+ * @param send Sends a chunk and reports the toxcore result.
+ */
+void SendqControl::iterate(const Sender& send)
+{
+    for (auto it = friends.begin(); it != friends.end();) {
+        auto& state = *it;
+        if (state.transfers.isEmpty()) {
+            // keep the learned budget only while the friend has a backlog
+            if (state.skip == 0) {
+                it = friends.erase(it);
+            } else {
+                --state.skip;
+                ++it;
+            }
+
+            continue;
+        }
+
+        if (state.skip > 0) {
+            --state.skip;
+            ++it;
+            continue;
+        }
+
+        auto sent = 0;
+        auto blocked = false;
+        while (sent < state.budget && !state.transfers.isEmpty() && !blocked) {
+            // round robin over the transfers of the friend
+            const auto key = state.transfers.takeFirst();
+            const auto err = send(key, pending[key].head());
+            // the sender may have forgotten the transfer, look it up again
+            auto queue = pending.find(key);
+            if (queue == pending.end()) {
+                continue;
+            }
+
+            if (err == Files::ErrFileSendChunk::Ok) {
+                queue->dequeue();
+                ++sent;
+            } else if (err == Files::ErrFileSendChunk::Sendq) {
+                blocked = true;
+            } else {
+                // the transfer is gone, e.g. the friend went offline
+                queue->clear();
+            }
+
+            if (queue->isEmpty()) {
+                pending.erase(queue);
+            } else {
+                state.transfers.append(key);
+            }
+        }
+
+        if (blocked) {
+            backOff(state);
+        } else if (sent > 0) {
+            state.backoff = 0;
+            state.budget = std::min(state.budget + BudgetStep, MaxBudget);
+        }
+
+        ++it;
+    }
+}
+
+/**
+ * @brief Number of chunks waiting for a resend over all transfers.
+ */
+int SendqControl::getPendingCount() const
+{
+    auto count = 0;
+    for (const auto& queue : pending) {
+        count += queue.size();
+    }
+
+    return count;
+}
+
+void SendqControl::backOff(FriendState& state)
+{
+    state.budget = std::max(state.budget / 2, MinBudget);
+    state.backoff = std::min(std::max(state.backoff * 2, 1), MaxBackoff);
+    state.skip = state.backoff;
+}
+
+}
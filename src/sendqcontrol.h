@@ -0,0 +1,59 @@
+#ifndef _QT_TOX_SENDQ_CONTROL_H_
+#define _QT_TOX_SENDQ_CONTROL_H_
+
+#include "chunkbuffer.h"
+#include "files.h"
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace QtTox
+{
+
+struct SendqChunk
+{
+    uint64_t position;
+    size_t length;
+    // the data is read from the send source again if neither is set
+    QByteArray bytes;
+    ChunkBuffer buffer;
+};
+
+class SendqControl
+{
+public:
+    using Sender = std::function<Files::ErrFileSendChunk(quint64 key, const SendqChunk& chunk)>;
+
+    bool isBlocked(quint64 key) const;
+    void defer(quint64 key, const SendqChunk& chunk);
+    void rejected(uint32_t friendNum);
+    void forget(quint64 key);
+    void iterate(const Sender& send);
+
+    int getPendingCount() const;
+
+private:
+    struct FriendState
+    {
+        QList<quint64> transfers;
+        int budget = 8;
+        int backoff = 0;
+        int skip = 0;
+    };
+
+    void backOff(FriendState& state);
+
+private:
+    QHash<quint64, QQueue<SendqChunk>> pending;
+    QHash<uint32_t, FriendState> friends;
+};
+
+}
+
+#endif // _QT_TOX_SENDQ_CONTROL_H_
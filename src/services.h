@@ -6,13 +6,19 @@ namespace QtTox
 
 class Messenger;
 class ChatList;
+class Conference;
 class Files;
+class LowLevel;
+class Self;
 
 struct Services
 {
     Messenger*  messenger;
     ChatList*   chatList;
+    Conference* conference;
     Files*      files;
+    LowLevel*   lowLevel;
+    Self*       self;
 };
 
 }
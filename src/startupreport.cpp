@@ -0,0 +1,167 @@
+#include "startupreport.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QThread>
+
+#include <algorithm>
+
+namespace
+{
+
+// a report only covers startup, this bounds it if startup never ends
+const int MaxPhases = 1024;
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class StartupReport
+ * @brief Monotonic timings of the phases of startup.
+ *
+ * A phase is recorded when it ends, with the time it started. Phases may
+ * run on several threads at once and may nest, the report keeps them in the
+ * order they ended. Timestamps come from one monotonic clock started with
+ * the report, so they are comparable across threads.
+ */
+
+StartupReport::StartupReport()
+{
+    clock.start();
+    threads.append(QThread::currentThreadId());
+}
+
+/**
+ * @brief Current time in nanoseconds, pass it to record() when the phase ends.
+ */
+qint64 StartupReport::now() const
+{
+    return clock.nsecsElapsed();
+}
+
+/**
+ * @brief Records a phase that started at startNs and ends now.
+ */
+void StartupReport::record(const QString& name, qint64 startNs)
+{
+    const auto end = clock.nsecsElapsed();
+    const auto threadId = QThread::currentThreadId();
+    QMutexLocker locker{&mutex};
+    auto thread = threads.indexOf(threadId);
+    if (thread < 0) {
+        thread = threads.size();
+        threads.append(threadId);
+    }
+
+    if (phases.size() >= MaxPhases) {
+        ++dropped;
+        return;
+    }
+
+    phases.append(Phase{name, startNs, end - startNs, thread});
+}
+
+QVector<StartupReport::Phase> StartupReport::getPhases() const
+{
+    QMutexLocker locker{&mutex};
+    return phases;
+}
+
+/**
+ * @brief Number of phases not recorded because the report was full.
+ */
+int StartupReport::getDroppedCount() const
+{
+    QMutexLocker locker{&mutex};
+    return dropped;
+}
+
+/**
+ * @brief Time from the creation of the report to the end of the last phase.
+ */
+qint64 StartupReport::getTotalNs() const
+{
+    QMutexLocker locker{&mutex};
+    auto total = qint64{0};
+    for (const auto& phase : phases) {
+        total = std::max(total, phase.startNs + phase.durationNs);
+    }
+
+    return total;
+}
+
+/**
+ * @brief One line per phase in start order, for logs.
+ */
+QString StartupReport::toText() const
+{
+    auto sorted = getPhases();
+    std::stable_sort(sorted.begin(), sorted.end(), [](const Phase& a, const Phase& b) {
+        return a.startNs < b.startNs;
+    });
+
+    auto text = QString{};
+    for (const auto& phase : sorted) {
+        text += QStringLiteral("%1 ms +%2 ms [%3] %4\n")
+                .arg(phase.startNs / 1e6, 0, 'f', 3)
+                .arg(phase.durationNs / 1e6, 0, 'f', 3)
+                .arg(phase.thread)
+                .arg(phase.name);
+    }
+
+    const auto droppedPhases = getDroppedCount();
+    if (droppedPhases > 0) {
+        text += QStringLiteral("%1 phases dropped\n").arg(droppedPhases);
+    }
+
+    text += QStringLiteral("total %1 ms\n").arg(getTotalNs() / 1e6, 0, 'f', 3);
+    return text;
+}
+
+/**
+ * @brief The phases in the Trace Event Format, loadable in chrome://tracing
+ * or Perfetto.
+ */
+QByteArray StartupReport::toTraceJson() const
+{
+    auto events = QJsonArray{};
+    for (const auto& phase : getPhases()) {
+        events.append(QJsonObject{
+            { QStringLiteral("name"), phase.name },
+            { QStringLiteral("ph"),   QStringLiteral("X") },
+            { QStringLiteral("ts"),   phase.startNs / 1e3 },
+            { QStringLiteral("dur"),  phase.durationNs / 1e3 },
+            { QStringLiteral("pid"),  1 },
+            { QStringLiteral("tid"),  phase.thread },
+        });
+    }
+
+    const auto trace = QJsonObject{
+        { QStringLiteral("traceEvents"),     events },
+        { QStringLiteral("displayTimeUnit"), QStringLiteral("ms") },
+    };
+    return QJsonDocument{trace}.toJson(QJsonDocument::Compact);
+}
+
+bool StartupReport::writeTrace(const QString& path) const
+{
+    QSaveFile file{path};
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+
+    const auto json = toTraceJson();
+    if (file.write(json) != json.size()) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+}
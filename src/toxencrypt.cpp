@@ -18,13 +18,26 @@
 */
 
 #include "toxencrypt.h"
+#include "passkeycache.h"
 #include <tox/tox.h>  // TOX_VERSION_IS_API_COMPATIBLE
 #include <tox/toxencryptsave.h>
 
 #include <QByteArray>
 #include <QDebug>
+#include <QIODevice>
+#include <QRandomGenerator>
+#include <QRunnable>
+#include <QSemaphore>
 #include <QString>
+#include <QThread>
+#include <QThreadPool>
+#include <QtEndian>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
 #include <memory>
+#include <vector>
 
 // functions for nice debug output
 static QString getKeyDerivationError(TOX_ERR_KEY_DERIVATION error);
@@ -32,6 +45,48 @@ static QString getEncryptionError(TOX_ERR_ENCRYPTION error);
 static QString getDecryptionError(TOX_ERR_DECRYPTION error);
 static QString getSaltError(TOX_ERR_GET_SALT error);
 
+// stream format: magic, then the stream tag, which is the plaintext chunk
+// size as big endian uint32 and a random stream ID, then chunks that each
+// seal the stream tag, their index and a final flag with the data
+static const char StreamMagic[] = {'q', 'T', 'E', 'S', 0x00, 0x02};
+static const int StreamMagicLength = sizeof(StreamMagic);
+static const int StreamIdLength = 16;
+static const int StreamTagLength = 4 + StreamIdLength;
+static const int StreamHeaderLength = StreamMagicLength + StreamTagLength;
+static const int ChunkHeaderLength = StreamTagLength + 9;
+static const int MaxChunkSize = 16 * 1024 * 1024;
+
+// batches smaller than this are not worth handing to other threads
+static const qint64 MinBytesPerThread = 256 * 1024;
+
+class BatchJob : public QRunnable
+{
+public:
+    BatchJob(std::function<void()> work, QSemaphore* done)
+        : work{std::move(work)}
+        , done{done}
+    {
+    }
+
+    void run() override
+    {
+        work();
+        done->release();
+    }
+
+private:
+    std::function<void()> work;
+    QSemaphore* done;
+};
+
+static int readStreamHeader(QIODevice& in, char* tag);
+static bool readFully(QIODevice& in, char* buffer, int length, int* read);
+
+// key derivation shared by the factories and the password functions
+static std::shared_ptr<Tox_Pass_Key> deriveKey(const QByteArray& pass, const uint8_t* salt);
+static QByteArray getSalt(const QByteArray& ciphertext);
+static std::shared_ptr<Tox_Pass_Key> getCachedKey(const QByteArray& pass, const QByteArray& salt);
+
 namespace QtTox
 {
 
@@ -41,22 +96,21 @@ namespace QtTox
   * Since key derivation is work intensive and to avoid storing plaintext
   * passwords in memory, use a ToxEncrypt object and encrypt() or decrypt()
   * when you have to encrypt or decrypt more than once with the same password.
+  *
+  * Derived keys are cached by salt and password, so repeated derivations for
+  * the same profile are free. The *Async() variants derive on a worker thread
+  * and keep the calling thread responsive while a key is derived.
   */
 
-/**
- * @brief Frees the passKey before destruction.
- */
-ToxEncrypt::~ToxEncrypt()
-{
-    tox_pass_key_free(passKey);
-}
+ToxEncrypt::~ToxEncrypt() = default;
 
 /**
  * @brief Constructs a ToxEncrypt object from a Tox_Pass_Key.
- * @param key Derived key to use for encryption and decryption.
+ * @param key Derived key to use for encryption and decryption, possibly
+ *        shared with the key cache.
  */
-ToxEncrypt::ToxEncrypt(Tox_Pass_Key* key)
-    : passKey{key}
+ToxEncrypt::ToxEncrypt(std::shared_ptr<Tox_Pass_Key> key)
+    : passKey{std::move(key)}
 {
 }
 
@@ -97,21 +151,18 @@ QByteArray ToxEncrypt::encryptPass(const QString& password, const QByteArray& pl
         qWarning() << "Empty password supplied, probably not what you intended.";
     }
 
-    QByteArray pass = password.toUtf8();
-    QByteArray ciphertext(plaintext.length() + TOX_PASS_ENCRYPTION_EXTRA_LENGTH, 0x00);
-    TOX_ERR_ENCRYPTION error;
-    tox_pass_encrypt(reinterpret_cast<const uint8_t*>(plaintext.constData()),
-                     static_cast<size_t>(plaintext.size()),
-                     reinterpret_cast<const uint8_t*>(pass.constData()),
-                     static_cast<size_t>(pass.size()),
-                     reinterpret_cast<uint8_t*>(ciphertext.data()), &error);
-
-    if (error != TOX_ERR_ENCRYPTION_OK) {
-        qCritical() << getEncryptionError(error);
-        return QByteArray{};
+    // reusing the salt of an earlier derivation skips the slow key derivation,
+    // the nonce still differs for every encryption
+    const QByteArray pass = password.toUtf8();
+    std::shared_ptr<Tox_Pass_Key> passKey = PassKeyCache::instance().findAny(pass);
+    if (!passKey) {
+        passKey = deriveKey(pass, nullptr);
+        if (!passKey) {
+            return QByteArray{};
+        }
     }
 
-    return ciphertext;
+    return ToxEncrypt{passKey}.encrypt(plaintext);
 }
 
 
@@ -132,21 +183,13 @@ QByteArray ToxEncrypt::decryptPass(const QString& password, const QByteArray& ci
         qDebug() << "Empty password supplied, probably not what you intended.";
     }
 
-    QByteArray pass = password.toUtf8();
-    QByteArray plaintext(ciphertext.length() - TOX_PASS_ENCRYPTION_EXTRA_LENGTH, 0x00);
-    TOX_ERR_DECRYPTION error;
-    tox_pass_decrypt(reinterpret_cast<const uint8_t*>(ciphertext.constData()),
-                     static_cast<size_t>(ciphertext.size()),
-                     reinterpret_cast<const uint8_t*>(pass.constData()),
-                     static_cast<size_t>(pass.size()), reinterpret_cast<uint8_t*>(plaintext.data()),
-                     &error);
-
-    if (error != TOX_ERR_DECRYPTION_OK) {
-        qWarning() << getDecryptionError(error);
+    const std::shared_ptr<Tox_Pass_Key> passKey = getCachedKey(password.toUtf8(),
+                                                               getSalt(ciphertext));
+    if (!passKey) {
         return QByteArray{};
     }
 
-    return plaintext;
+    return ToxEncrypt{passKey}.decrypt(ciphertext);
 }
 
 /**
@@ -159,21 +202,8 @@ QByteArray ToxEncrypt::decryptPass(const QString& password, const QByteArray& ci
  */
 std::unique_ptr<ToxEncrypt> ToxEncrypt::makeToxEncrypt(const QString& password)
 {
-    const QByteArray pass = password.toUtf8();
-    TOX_ERR_KEY_DERIVATION error;
-#if TOX_VERSION_IS_API_COMPATIBLE(0, 2, 0)
-    Tox_Pass_Key* const passKey = tox_pass_key_derive(
-        reinterpret_cast<const uint8_t*>(pass.constData()),
-        static_cast<size_t>(pass.length()), &error);
-#else
-    Tox_Pass_Key* const passKey = tox_pass_key_new();
-    tox_pass_key_derive(passKey, reinterpret_cast<const uint8_t*>(pass.constData()),
-                        static_cast<size_t>(pass.length()), &error);
-#endif
-
-    if (error != TOX_ERR_KEY_DERIVATION_OK) {
-        tox_pass_key_free(passKey);
-        qCritical() << getKeyDerivationError(error);
+    std::shared_ptr<Tox_Pass_Key> passKey = deriveKey(password.toUtf8(), nullptr);
+    if (!passKey) {
         return std::unique_ptr<ToxEncrypt>{};
     }
 
@@ -196,34 +226,68 @@ std::unique_ptr<ToxEncrypt> ToxEncrypt::makeToxEncrypt(const QString& password,
         return std::unique_ptr<ToxEncrypt>{};
     }
 
-    TOX_ERR_GET_SALT saltError;
-    uint8_t salt[TOX_PASS_SALT_LENGTH];
-    tox_get_salt(reinterpret_cast<const uint8_t*>(toxSave.constData()), salt, &saltError);
-
-    if (saltError != TOX_ERR_GET_SALT_OK) {
-        qWarning() << getSaltError(saltError);
+    std::shared_ptr<Tox_Pass_Key> passKey = getCachedKey(password.toUtf8(), getSalt(toxSave));
+    if (!passKey) {
         return std::unique_ptr<ToxEncrypt>{};
     }
 
-    QByteArray pass = password.toUtf8();
-    TOX_ERR_KEY_DERIVATION keyError;
-#if TOX_VERSION_IS_API_COMPATIBLE(0, 2, 0)
-    Tox_Pass_Key* const passKey = tox_pass_key_derive_with_salt(
-        reinterpret_cast<const uint8_t*>(pass.constData()),
-        static_cast<size_t>(pass.length()), salt, &keyError);
-#else
-    Tox_Pass_Key* const passKey = tox_pass_key_new();
-    tox_pass_key_derive_with_salt(passKey, reinterpret_cast<const uint8_t*>(pass.constData()),
-                                  static_cast<size_t>(pass.length()), salt, &keyError);
-#endif
+    return std::unique_ptr<ToxEncrypt>(new ToxEncrypt(passKey));
+}
 
-    if (keyError != TOX_ERR_KEY_DERIVATION_OK) {
-        tox_pass_key_free(passKey);
-        qWarning() << getKeyDerivationError(keyError);
-        return std::unique_ptr<ToxEncrypt>{};
-    }
+/**
+ * @brief  Runs encryptPass() on a worker thread.
+ * @return Future of the encrypted data, empty on failure.
+ */
+std::future<QByteArray> ToxEncrypt::encryptPassAsync(const QString& password,
+                                                     const QByteArray& plaintext)
+{
+    return std::async(std::launch::async, [password, plaintext]() {
+        return encryptPass(password, plaintext);
+    });
+}
 
-    return std::unique_ptr<ToxEncrypt>(new ToxEncrypt(passKey));
+/**
+ * @brief  Runs decryptPass() on a worker thread.
+ * @return Future of the plaintext, empty on failure.
+ */
+std::future<QByteArray> ToxEncrypt::decryptPassAsync(const QString& password,
+                                                     const QByteArray& ciphertext)
+{
+    return std::async(std::launch::async, [password, ciphertext]() {
+        return decryptPass(password, ciphertext);
+    });
+}
+
+/**
+ * @brief  Runs makeToxEncrypt() on a worker thread.
+ * @return Future of the ToxEncrypt object, empty on failure.
+ */
+std::future<std::unique_ptr<ToxEncrypt>> ToxEncrypt::makeToxEncryptAsync(const QString& password)
+{
+    return std::async(std::launch::async, [password]() {
+        return makeToxEncrypt(password);
+    });
+}
+
+/**
+ * @brief  Runs makeToxEncrypt() with the salt of toxSave on a worker thread.
+ * @return Future of the ToxEncrypt object, empty on failure.
+ */
+std::future<std::unique_ptr<ToxEncrypt>> ToxEncrypt::makeToxEncryptAsync(const QString& password,
+                                                                         const QByteArray& toxSave)
+{
+    return std::async(std::launch::async, [password, toxSave]() {
+        return makeToxEncrypt(password, toxSave);
+    });
+}
+
+/**
+ * @brief Forgets all cached keys, e.g. when the profile is closed or its
+ *        password changes.
+ */
+void ToxEncrypt::clearKeyCache()
+{
+    PassKeyCache::instance().clear();
 }
 
 /**
@@ -238,9 +302,9 @@ QByteArray ToxEncrypt::encrypt(const QByteArray& plaintext) const
         return QByteArray{};
     }
 
-    QByteArray ciphertext(plaintext.length() + TOX_PASS_ENCRYPTION_EXTRA_LENGTH, 0x00);
+    QByteArray ciphertext(plaintext.length() + TOX_PASS_ENCRYPTION_EXTRA_LENGTH, Qt::Uninitialized);
     TOX_ERR_ENCRYPTION error;
-    tox_pass_key_encrypt(passKey, reinterpret_cast<const uint8_t*>(plaintext.constData()),
+    tox_pass_key_encrypt(passKey.get(), reinterpret_cast<const uint8_t*>(plaintext.constData()),
                          static_cast<size_t>(plaintext.size()),
                          reinterpret_cast<uint8_t*>(ciphertext.data()), &error);
 
@@ -265,9 +329,9 @@ QByteArray ToxEncrypt::decrypt(const QByteArray& ciphertext) const
         return QByteArray{};
     }
 
-    QByteArray plaintext(ciphertext.length() - TOX_PASS_ENCRYPTION_EXTRA_LENGTH, 0x00);
+    QByteArray plaintext(ciphertext.length() - TOX_PASS_ENCRYPTION_EXTRA_LENGTH, Qt::Uninitialized);
     TOX_ERR_DECRYPTION error;
-    tox_pass_key_decrypt(passKey, reinterpret_cast<const uint8_t*>(ciphertext.constData()),
+    tox_pass_key_decrypt(passKey.get(), reinterpret_cast<const uint8_t*>(ciphertext.constData()),
                          static_cast<size_t>(ciphertext.size()),
                          reinterpret_cast<uint8_t*>(plaintext.data()), &error);
 
@@ -279,6 +343,340 @@ QByteArray ToxEncrypt::decrypt(const QByteArray& ciphertext) const
     return plaintext;
 }
 
+/**
+ * @brief  Encrypts many records with the stored key, in parallel.
+ * @param  records The plaintexts, each one is encrypted on its own.
+ * @return The encrypted records, back to back in one buffer.
+ *
+ * The output size is known in advance, so the buffer is allocated once and
+ * every thread writes its share of records straight into it.
+ */
+ToxEncrypt::Batch ToxEncrypt::encryptMany(const QVector<QByteArray>& records) const
+{
+    return processMany(records, true);
+}
+
+/**
+ * @brief  Decrypts many records encrypted with the stored key, in parallel.
+ * @param  records The ciphertexts, e.g. as returned by encrypt().
+ * @return The plaintexts, back to back in one buffer.
+ */
+ToxEncrypt::Batch ToxEncrypt::decryptMany(const QVector<QByteArray>& records) const
+{
+    return processMany(records, false);
+}
+
+ToxEncrypt::Batch ToxEncrypt::processMany(const QVector<QByteArray>& records, bool encrypting) const
+{
+    const int count = records.size();
+    Batch batch;
+    batch.offsets.resize(count + 1);
+    batch.ok.fill(false, count);
+    if (!passKey) {
+        qCritical() << "The passKey is invalid.";
+        batch.offsets.fill(0);
+        return batch;
+    }
+
+    qint64 total = 0;
+    for (int i = 0; i < count; ++i) {
+        batch.offsets[i] = static_cast<int>(total);
+        const int size = records[i].size();
+        if (encrypting) {
+            total += size + TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
+        } else if (size >= TOX_PASS_ENCRYPTION_EXTRA_LENGTH) {
+            total += size - TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
+        }
+
+        if (total > std::numeric_limits<int>::max()) {
+            qCritical() << "The batch is too large.";
+            batch.offsets.fill(0);
+            return batch;
+        }
+    }
+
+    batch.offsets[count] = static_cast<int>(total);
+    if (count == 0) {
+        return batch;
+    }
+
+    batch.data = QByteArray(static_cast<int>(total), Qt::Uninitialized);
+
+    // raw pointers, the containers must not be touched from several threads
+    uint8_t* const arena = reinterpret_cast<uint8_t*>(batch.data.data());
+    const int* const offsets = batch.offsets.constData();
+    bool* const ok = batch.ok.data();
+    Tox_Pass_Key* const key = passKey.get();
+    const auto process = [&records, arena, offsets, ok, key, encrypting](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            const QByteArray& record = records[i];
+            const uint8_t* const in = reinterpret_cast<const uint8_t*>(record.constData());
+            uint8_t* const out = arena + offsets[i];
+            if (encrypting) {
+                TOX_ERR_ENCRYPTION error;
+                ok[i] = tox_pass_key_encrypt(key, in, static_cast<size_t>(record.size()),
+                                             out, &error);
+            } else if (record.size() >= TOX_PASS_ENCRYPTION_EXTRA_LENGTH) {
+                TOX_ERR_DECRYPTION error;
+                ok[i] = tox_pass_key_decrypt(key, in, static_cast<size_t>(record.size()),
+                                             out, &error);
+            }
+        }
+    };
+
+    // split into ranges of about the same number of bytes, one per thread
+    const int threads = static_cast<int>(std::min<qint64>(
+        std::max(QThread::idealThreadCount(), 1), std::max<qint64>(total / MinBytesPerThread, 1)));
+    QVector<int> bounds{0};
+    for (int i = 0, part = 1; i < count && part < threads; ++i) {
+        if (offsets[i + 1] >= total * part / threads) {
+            bounds.append(i + 1);
+            ++part;
+        }
+    }
+
+    if (bounds.last() != count) {
+        bounds.append(count);
+    }
+
+    // the calling thread takes the first range instead of waiting idle
+    QSemaphore done;
+    QThreadPool* const pool = QThreadPool::globalInstance();
+    std::vector<std::unique_ptr<BatchJob>> jobs;
+    for (int i = 1; i + 1 < bounds.size(); ++i) {
+        const int begin = bounds[i];
+        const int end = bounds[i + 1];
+        jobs.emplace_back(new BatchJob{[process, begin, end]() {
+            process(begin, end);
+        }, &done});
+        jobs.back()->setAutoDelete(false);
+        pool->start(jobs.back().get());
+    }
+
+    process(bounds[0], bounds[1]);
+
+    // the caller may be a pool thread itself, with the pool busy the jobs
+    // might never start, so it runs those still queued before waiting
+    for (const auto& job : jobs) {
+        if (pool->tryTake(job.get())) {
+            job->run();
+        }
+    }
+
+    done.acquire(static_cast<int>(jobs.size()));
+    return batch;
+}
+
+/**
+ * @brief  Encrypts a stream in authenticated chunks with the stored key.
+ * @param  in Device to read the plaintext from until its end.
+ * @param  out Device to write the encrypted stream to.
+ * @param  chunkSize Plaintext bytes per chunk, the unit of random access.
+ * @return True on success.
+ *
+ * Every chunk seals the random ID of its stream, its index and whether it
+ * is the last one, so chunks can't be reordered, dropped, cut off or moved
+ * between streams encrypted with the same key without decryption failing.
+ * Memory use is bounded by the chunk size, whatever the size of the stream.
+ */
+bool ToxEncrypt::encryptStream(QIODevice& in, QIODevice& out, int chunkSize) const
+{
+    if (!passKey || chunkSize <= 0 || chunkSize > MaxChunkSize) {
+        qCritical() << "The passKey or the chunk size is invalid.";
+        return false;
+    }
+
+    char header[StreamHeaderLength];
+    char* const tag = header + StreamMagicLength;
+    quint32 streamId[StreamIdLength / sizeof(quint32)];
+    QRandomGenerator::system()->fillRange(streamId);
+    memcpy(header, StreamMagic, StreamMagicLength);
+    qToBigEndian(static_cast<quint32>(chunkSize), tag);
+    memcpy(tag + 4, streamId, StreamIdLength);
+    if (out.write(header, StreamHeaderLength) != StreamHeaderLength) {
+        return false;
+    }
+
+    // data is read behind room for the chunk header, plus one byte of
+    // lookahead that tells whether the chunk is the last one
+    QByteArray plain(ChunkHeaderLength + chunkSize + 1, Qt::Uninitialized);
+    QByteArray sealed(ChunkHeaderLength + chunkSize + TOX_PASS_ENCRYPTION_EXTRA_LENGTH,
+                      Qt::Uninitialized);
+    char* const data = plain.data() + ChunkHeaderLength;
+    int length = 0;
+    if (!readFully(in, data, chunkSize + 1, &length)) {
+        return false;
+    }
+
+    for (uint64_t index = 0;; ++index) {
+        const bool final = length <= chunkSize;
+        const int dataLength = final ? length : chunkSize;
+        if (!sealChunk(tag, index, final, plain, dataLength, sealed)) {
+            return false;
+        }
+
+        const qint64 sealedLength = ChunkHeaderLength + dataLength + TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
+        if (out.write(sealed.constData(), sealedLength) != sealedLength) {
+            return false;
+        }
+
+        if (final) {
+            return true;
+        }
+
+        data[0] = data[chunkSize];
+        if (!readFully(in, data + 1, chunkSize, &length)) {
+            return false;
+        }
+
+        length += 1;
+    }
+}
+
+/**
+ * @brief  Decrypts a stream written by encryptStream().
+ * @param  in Device to read the encrypted stream from.
+ * @param  out Device to write the plaintext to.
+ * @return True if the whole stream was authentic and written.
+ *
+ * Plaintext is written chunk by chunk, on failure out may hold an authentic
+ * prefix of it.
+ */
+bool ToxEncrypt::decryptStream(QIODevice& in, QIODevice& out) const
+{
+    char tag[StreamTagLength];
+    const int chunkSize = readStreamHeader(in, tag);
+    if (chunkSize <= 0) {
+        return false;
+    }
+
+    const int maxSealed = ChunkHeaderLength + chunkSize + TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
+    QByteArray sealed(maxSealed, Qt::Uninitialized);
+    QByteArray plain(ChunkHeaderLength + chunkSize, Qt::Uninitialized);
+    for (uint64_t index = 0;; ++index) {
+        int length = 0;
+        bool final = false;
+        if (!readFully(in, sealed.data(), maxSealed, &length)
+                || !openChunk(sealed, length, tag, index, &final, plain)) {
+            return false;
+        }
+
+        const qint64 dataLength = length - ChunkHeaderLength - TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
+        if (out.write(plain.constData() + ChunkHeaderLength, dataLength) != dataLength) {
+            return false;
+        }
+
+        if (final) {
+            return in.atEnd();
+        }
+
+        if (length != maxSealed) {
+            qWarning() << "The encrypted stream is truncated.";
+            return false;
+        }
+    }
+}
+
+/**
+ * @brief  Decrypts a single chunk of a stream written by encryptStream().
+ * @param  in Seekable device holding the encrypted stream.
+ * @param  index Number of the chunk, chunk i holds the plaintext from byte
+ *         i * chunkSize on.
+ * @return The plaintext of the chunk or an empty QByteArray on failure.
+ */
+QByteArray ToxEncrypt::decryptStreamChunk(QIODevice& in, uint64_t index) const
+{
+    if (in.isSequential() || !in.seek(0)) {
+        return QByteArray{};
+    }
+
+    char tag[StreamTagLength];
+    const int chunkSize = readStreamHeader(in, tag);
+    if (chunkSize <= 0) {
+        return QByteArray{};
+    }
+
+    const int maxSealed = ChunkHeaderLength + chunkSize + TOX_PASS_ENCRYPTION_EXTRA_LENGTH;
+    if (index > static_cast<uint64_t>(std::numeric_limits<qint64>::max() / maxSealed - 1)
+            || !in.seek(StreamHeaderLength + static_cast<qint64>(index) * maxSealed)) {
+        return QByteArray{};
+    }
+
+    QByteArray sealed(maxSealed, Qt::Uninitialized);
+    QByteArray plain(ChunkHeaderLength + chunkSize, Qt::Uninitialized);
+    int length = 0;
+    bool final = false;
+    if (!readFully(in, sealed.data(), maxSealed, &length)
+            || !openChunk(sealed, length, tag, index, &final, plain)) {
+        return QByteArray{};
+    }
+
+    return plain.mid(ChunkHeaderLength, length - ChunkHeaderLength - TOX_PASS_ENCRYPTION_EXTRA_LENGTH);
+}
+
+/**
+ * @brief Encrypts one chunk of a stream.
+ * @param tag Stream tag from the stream header.
+ * @param plain Chunk header room followed by length bytes of data.
+ * @param sealed Receives the encrypted chunk.
+ */
+bool ToxEncrypt::sealChunk(const char* tag, uint64_t index, bool final, QByteArray& plain,
+                           int length, QByteArray& sealed) const
+{
+    memcpy(plain.data(), tag, StreamTagLength);
+    qToBigEndian(static_cast<quint64>(index), plain.data() + StreamTagLength);
+    plain[StreamTagLength + 8] = final ? 1 : 0;
+
+    TOX_ERR_ENCRYPTION error;
+    tox_pass_key_encrypt(passKey.get(), reinterpret_cast<const uint8_t*>(plain.constData()),
+                         static_cast<size_t>(ChunkHeaderLength + length),
+                         reinterpret_cast<uint8_t*>(sealed.data()), &error);
+
+    if (error != TOX_ERR_ENCRYPTION_OK) {
+        qCritical() << getEncryptionError(error);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Decrypts one chunk of a stream and checks its stream and position.
+ * @param tag Stream tag from the stream header.
+ * @param plain Receives the chunk header followed by the data.
+ */
+bool ToxEncrypt::openChunk(const QByteArray& sealed, int length, const char* tag,
+                           uint64_t index, bool* final, QByteArray& plain) const
+{
+    if (!passKey || length < ChunkHeaderLength + TOX_PASS_ENCRYPTION_EXTRA_LENGTH) {
+        qWarning() << "The encrypted stream is truncated.";
+        return false;
+    }
+
+    TOX_ERR_DECRYPTION error;
+    tox_pass_key_decrypt(passKey.get(), reinterpret_cast<const uint8_t*>(sealed.constData()),
+                         static_cast<size_t>(length),
+                         reinterpret_cast<uint8_t*>(plain.data()), &error);
+
+    if (error != TOX_ERR_DECRYPTION_OK) {
+        qWarning() << getDecryptionError(error);
+        return false;
+    }
+
+    if (memcmp(plain.constData(), tag, StreamTagLength) != 0) {
+        qWarning() << "The encrypted stream has chunks of another stream.";
+        return false;
+    }
+
+    if (qFromBigEndian<quint64>(plain.constData() + StreamTagLength) != index) {
+        qWarning() << "The encrypted stream has chunks out of order.";
+        return false;
+    }
+
+    *final = plain[StreamTagLength + 8] != 0;
+    return true;
+}
+
 }
 
 /**
@@ -367,3 +765,144 @@ QString getSaltError(TOX_ERR_GET_SALT error)
         return QStringLiteral("Unknown salt error.");
     }
 }
+
+/**
+ * @brief Derives a key and adds it to the key cache.
+ * @param pass The UTF-8 password.
+ * @param salt Salt of TOX_PASS_SALT_LENGTH bytes, nullptr for a random one.
+ * @return The key, or an empty pointer on failure.
+ */
+std::shared_ptr<Tox_Pass_Key> deriveKey(const QByteArray& pass, const uint8_t* salt)
+{
+    TOX_ERR_KEY_DERIVATION error;
+    const uint8_t* const passData = reinterpret_cast<const uint8_t*>(pass.constData());
+    const size_t passLength = static_cast<size_t>(pass.length());
+#if TOX_VERSION_IS_API_COMPATIBLE(0, 2, 0)
+    Tox_Pass_Key* const passKey = salt
+        ? tox_pass_key_derive_with_salt(passData, passLength, salt, &error)
+        : tox_pass_key_derive(passData, passLength, &error);
+#else
+    Tox_Pass_Key* const passKey = tox_pass_key_new();
+    if (salt) {
+        tox_pass_key_derive_with_salt(passKey, passData, passLength, salt, &error);
+    } else {
+        tox_pass_key_derive(passKey, passData, passLength, &error);
+    }
+#endif
+
+    if (error != TOX_ERR_KEY_DERIVATION_OK) {
+        tox_pass_key_free(passKey);
+        qCritical() << getKeyDerivationError(error);
+        return std::shared_ptr<Tox_Pass_Key>{};
+    }
+
+    const std::shared_ptr<Tox_Pass_Key> key{passKey, tox_pass_key_free};
+    if (salt) {
+        QtTox::PassKeyCache::instance().insert(pass, QByteArray(reinterpret_cast<const char*>(salt),
+                                                         TOX_PASS_SALT_LENGTH), key);
+        return key;
+    }
+
+    // the salt of a random key is only exposed through the data it encrypts
+    const uint8_t probe = 0;
+    QByteArray ciphertext(1 + TOX_PASS_ENCRYPTION_EXTRA_LENGTH, 0x00);
+    TOX_ERR_ENCRYPTION encryptionError;
+    if (tox_pass_key_encrypt(passKey, &probe, 1, reinterpret_cast<uint8_t*>(ciphertext.data()),
+                             &encryptionError)) {
+        QtTox::PassKeyCache::instance().insert(pass, getSalt(ciphertext), key);
+    }
+
+    return key;
+}
+
+/**
+ * @brief Reads the salt from data encrypted with this module.
+ * @return The salt, or an empty QByteArray on failure.
+ */
+QByteArray getSalt(const QByteArray& ciphertext)
+{
+    if (!QtTox::ToxEncrypt::isEncrypted(ciphertext)) {
+        qWarning() << "The data was not encrypted using this module or it's corrupted.";
+        return QByteArray{};
+    }
+
+    TOX_ERR_GET_SALT error;
+    QByteArray salt(TOX_PASS_SALT_LENGTH, 0x00);
+    tox_get_salt(reinterpret_cast<const uint8_t*>(ciphertext.constData()),
+                 reinterpret_cast<uint8_t*>(salt.data()), &error);
+
+    if (error != TOX_ERR_GET_SALT_OK) {
+        qWarning() << getSaltError(error);
+        return QByteArray{};
+    }
+
+    return salt;
+}
+
+/**
+ * @brief Gets the key for the password and salt from the cache or derives it.
+ * @return The key, or an empty pointer on failure.
+ */
+std::shared_ptr<Tox_Pass_Key> getCachedKey(const QByteArray& pass, const QByteArray& salt)
+{
+    if (salt.isEmpty()) {
+        return std::shared_ptr<Tox_Pass_Key>{};
+    }
+
+    const std::shared_ptr<Tox_Pass_Key> key = QtTox::PassKeyCache::instance().find(pass, salt);
+    if (key) {
+        return key;
+    }
+
+    return deriveKey(pass, reinterpret_cast<const uint8_t*>(salt.constData()));
+}
+
+/**
+ * @brief Reads and checks the header of an encrypted stream.
+ * @param tag Receives the StreamTagLength bytes of the stream tag.
+ * @return The plaintext chunk size, or 0 if the header is invalid.
+ */
+int readStreamHeader(QIODevice& in, char* tag)
+{
+    char header[StreamHeaderLength];
+    if (in.read(header, StreamHeaderLength) != StreamHeaderLength
+            || memcmp(header, StreamMagic, StreamMagicLength) != 0) {
+        qWarning() << "The data is not an encrypted stream or it's corrupted.";
+        return 0;
+    }
+
+    const quint32 chunkSize = qFromBigEndian<quint32>(header + StreamMagicLength);
+    if (chunkSize == 0 || chunkSize > static_cast<quint32>(MaxChunkSize)) {
+        qWarning() << "The encrypted stream has an invalid chunk size.";
+        return 0;
+    }
+
+    memcpy(tag, header + StreamMagicLength, StreamTagLength);
+
+    return static_cast<int>(chunkSize);
+}
+
+/**
+ * @brief Reads until the buffer is full or the device ends.
+ * @param read Receives the number of bytes read.
+ * @return False on a read error.
+ */
+bool readFully(QIODevice& in, char* buffer, int length, int* read)
+{
+    *read = 0;
+    while (*read < length) {
+        const qint64 n = in.read(buffer + *read, length - *read);
+        if (n < 0) {
+            return false;
+        }
+
+        if (n == 0 && !in.waitForReadyRead(-1)) {
+            // sequential devices report 0 while more data may follow
+            break;
+        }
+
+        *read += static_cast<int>(n);
+    }
+
+    return true;
+}
@@ -0,0 +1,341 @@
+#include "transferjournal.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+
+#include <algorithm>
+
+namespace
+{
+
+const quint32 JournalMagic = 0x51544a31; // "QTJ1"
+const uint64_t BlockSize = 1024 * 1024;
+const qint64 FlushIntervalMs = 2000;
+
+enum RecordType : quint8
+{
+    RecordPut = 1,
+    RecordRemove = 2,
+};
+
+QByteArray entryId(const QByteArray& fileId, const QByteArray& publicKey)
+{
+    return fileId + publicKey;
+}
+
+int blockCount(uint64_t size)
+{
+    return static_cast<int>((size + BlockSize - 1) / BlockSize);
+}
+
+void writeEntry(QDataStream& out, const QtTox::TransferJournal::Entry& entry)
+{
+    out << static_cast<quint8>(RecordPut) << entry.fileId << entry.publicKey << entry.path
+        << static_cast<quint64>(entry.size) << entry.blocks;
+}
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class TransferJournal
+ * @brief Persists the progress of incoming transfers to resume them later.
+ *
+ * Transfers are identified by file ID and friend public key, progress is
+ * kept as a bitmap of received 1 MiB blocks. The journal file is a log of
+ * records where the last record of a transfer wins. flushIfDue() appends
+ * only the transfers that completed new blocks since the last flush, at
+ * most every two seconds, and the log is compacted once it is mostly made
+ * of outdated records.
+ *
+ * Received data may still be only in the pages of a mapping, so completed
+ * blocks are held back until a flush has synced the data of their transfer.
+ * A block in the journal is always on disk, a crash loses at most the
+ * blocks of the last interval.
+ */
+
+/**
+ * @brief Writes pending changes before destruction.
+ *
+ * Blocks that were never synced are dropped, they are received again on
+ * resume.
+ */
+TransferJournal::~TransferJournal()
+{
+    flush(Sync{});
+}
+
+/**
+ * @brief Loads the journal, creating it if it doesn't exist.
+ * @param path Location of the journal file.
+ * @return False if the journal can't be written.
+ */
+bool TransferJournal::open(const QString& path)
+{
+    this->path = path;
+    entries.clear();
+    active.clear();
+
+    QFile file{path};
+    if (file.open(QIODevice::ReadOnly)) {
+        QDataStream in{&file};
+        in.setVersion(QDataStream::Qt_5_0);
+        quint32 magic = 0;
+        in >> magic;
+        if (magic != JournalMagic) {
+            qWarning() << "Ignoring invalid transfer journal" << path;
+        }
+
+        while (magic == JournalMagic && !in.atEnd()) {
+            quint8 type = 0;
+            in >> type;
+            if (type == RecordPut) {
+                Entry entry;
+                quint64 size = 0;
+                in >> entry.fileId >> entry.publicKey >> entry.path >> size >> entry.blocks;
+                entry.size = size;
+                if (in.status() != QDataStream::Ok) {
+                    break;
+                }
+
+                entries.insert(entryId(entry.fileId, entry.publicKey), entry);
+            } else if (type == RecordRemove) {
+                QByteArray id;
+                in >> id;
+                if (in.status() != QDataStream::Ok) {
+                    break;
+                }
+
+                entries.remove(id);
+            } else {
+                // a torn record from an interrupted append, the rest is lost
+                break;
+            }
+        }
+    }
+
+    lastFlush.start();
+    return compact();
+}
+
+/**
+ * @brief Looks up a journaled transfer.
+ * @return True if the transfer was found and copied to entry.
+ */
+bool TransferJournal::find(const QByteArray& fileId, const QByteArray& publicKey,
+        Entry* entry) const
+{
+    auto it = entries.constFind(entryId(fileId, publicKey));
+    if (it == entries.constEnd()) {
+        return false;
+    }
+
+    if (entry) {
+        *entry = *it;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Gets the position to resume a journaled transfer from.
+ * @return Offset of the first block not received yet, or the file size.
+ */
+uint64_t TransferJournal::firstMissing(const Entry& entry)
+{
+    for (auto i = 0; i < entry.blocks.size(); ++i) {
+        if (!entry.blocks.testBit(i)) {
+            return static_cast<uint64_t>(i) * BlockSize;
+        }
+    }
+
+    return entry.size;
+}
+
+/**
+ * @brief Starts recording the progress of a transfer.
+ *
+ * A transfer already in the journal keeps its received blocks if the size
+ * still matches.
+ */
+void TransferJournal::begin(quint64 key, const QByteArray& fileId, const QByteArray& publicKey,
+        const QString& path, uint64_t size)
+{
+    const auto id = entryId(fileId, publicKey);
+    auto it = entries.find(id);
+    if (it == entries.end() || it->size != size) {
+        it = entries.insert(id, Entry{fileId, publicKey, path, size, QBitArray{blockCount(size)}});
+    } else {
+        it->path = path;
+    }
+
+    active.insert(key, Active{id, 0, 0, 0, {}});
+    removed.remove(id);
+    dirty.insert(id);
+}
+
+/**
+ * @brief Records a received chunk of a transfer started with begin().
+ *
+ * Chunks usually arrive in order, so they are merged into a run and a
+ * block is marked once the run covers all of it.
+ */
+void TransferJournal::received(quint64 key, uint64_t position, size_t length)
+{
+    auto it = active.find(key);
+    if (it == active.end()) {
+        return;
+    }
+
+    if (position != it->runEnd) {
+        it->runStart = position;
+        it->runEnd = position;
+        it->marked = 0;
+    }
+
+    it->runEnd += length;
+    markRun(*it);
+}
+
+/**
+ * @brief Forgets a transfer that completed or was canceled.
+ */
+void TransferJournal::remove(quint64 key)
+{
+    const auto it = active.find(key);
+    if (it == active.end()) {
+        return;
+    }
+
+    entries.remove(it->id);
+    dirty.remove(it->id);
+    removed.insert(it->id);
+    active.erase(it);
+}
+
+/**
+ * @brief Stops recording a transfer but keeps it in the journal.
+ */
+void TransferJournal::detach(quint64 key)
+{
+    active.remove(key);
+}
+
+/**
+ * @brief Appends changed transfers to the journal file.
+ * @param sync Called for every transfer with unsynced blocks, its blocks are
+ *        marked only if it returns true.
+ */
+void TransferJournal::flush(const Sync& sync)
+{
+    for (auto it = active.begin(); it != active.end(); ++it) {
+        if (it->unsynced.isEmpty() || !sync || !sync(it.key())) {
+            continue;
+        }
+
+        auto entry = entries.find(it->id);
+        for (const auto i : it->unsynced) {
+            if (entry != entries.end() && !entry->blocks.testBit(i)) {
+                entry->blocks.setBit(i);
+                dirty.insert(it->id);
+            }
+        }
+
+        it->unsynced.clear();
+    }
+
+    if (path.isEmpty() || (dirty.isEmpty() && removed.isEmpty())) {
+        return;
+    }
+
+    lastFlush.restart();
+    if (appended + dirty.size() + removed.size() > 4 * entries.size() + 64) {
+        compact();
+        return;
+    }
+
+    QFile file{path};
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "Can't write transfer journal" << path << file.errorString();
+        return;
+    }
+
+    QDataStream out{&file};
+    out.setVersion(QDataStream::Qt_5_0);
+    for (const auto& id : removed) {
+        out << static_cast<quint8>(RecordRemove) << id;
+    }
+
+    for (const auto& id : dirty) {
+        writeEntry(out, entries.value(id));
+    }
+
+    appended += dirty.size() + removed.size();
+    dirty.clear();
+    removed.clear();
+}
+
+/**
+ * @brief Calls flush() if the last flush is long enough ago.
+ */
+void TransferJournal::flushIfDue(const Sync& sync)
+{
+    if (lastFlush.isValid() && lastFlush.elapsed() >= FlushIntervalMs) {
+        flush(sync);
+    }
+}
+
+void TransferJournal::markRun(Active& run)
+{
+    auto it = entries.find(run.id);
+    if (it == entries.end()) {
+        return;
+    }
+
+    const auto first = static_cast<int>((run.runStart + BlockSize - 1) / BlockSize);
+    const auto end = run.runEnd >= it->size ? it->blocks.size()
+                                            : static_cast<int>(run.runEnd / BlockSize);
+    for (auto i = std::max(first, run.marked); i < end; ++i) {
+        if (!it->blocks.testBit(i)) {
+            run.unsynced.append(i);
+        }
+    }
+
+    run.marked = std::max(run.marked, end);
+}
+
+bool TransferJournal::compact()
+{
+    if (path.isEmpty()) {
+        return false;
+    }
+
+    QSaveFile file{path};
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't write transfer journal" << path << file.errorString();
+        return false;
+    }
+
+    QDataStream out{&file};
+    out.setVersion(QDataStream::Qt_5_0);
+    out << JournalMagic;
+    for (const auto& entry : entries) {
+        writeEntry(out, entry);
+    }
+
+    if (!file.commit()) {
+        qWarning() << "Can't write transfer journal" << path << file.errorString();
+        return false;
+    }
+
+    appended = entries.size();
+    dirty.clear();
+    removed.clear();
+    return true;
+}
+
+}
@@ -0,0 +1,79 @@
+#ifndef _QT_TOX_TRANSFER_JOURNAL_H_
+#define _QT_TOX_TRANSFER_JOURNAL_H_
+
+#include <QBitArray>
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace QtTox
+{
+
+class TransferJournal
+{
+public:
+    // writes the received data of a transfer to disk, true on success
+    using Sync = std::function<bool(quint64 key)>;
+
+    struct Entry
+    {
+        QByteArray fileId;
+        QByteArray publicKey;
+        QString path;
+        uint64_t size;
+        QBitArray blocks;
+    };
+
+    TransferJournal() = default;
+    TransferJournal(const TransferJournal& other) = delete;
+    TransferJournal& operator=(const TransferJournal& other) = delete;
+    ~TransferJournal();
+
+    bool open(const QString& path);
+
+    bool find(const QByteArray& fileId, const QByteArray& publicKey, Entry* entry) const;
+    static uint64_t firstMissing(const Entry& entry);
+
+    void begin(quint64 key, const QByteArray& fileId, const QByteArray& publicKey,
+            const QString& path, uint64_t size);
+    void received(quint64 key, uint64_t position, size_t length);
+    void remove(quint64 key);
+    void detach(quint64 key);
+
+    void flush(const Sync& sync);
+    void flushIfDue(const Sync& sync);
+
+private:
+    struct Active
+    {
+        QByteArray id;
+        uint64_t runStart;
+        uint64_t runEnd;
+        int marked;
+        // completed blocks whose data may not be on disk yet
+        QVector<int> unsynced;
+    };
+
+    void markRun(Active& run);
+    bool compact();
+
+private:
+    QString path;
+    QHash<QByteArray, Entry> entries;
+    QHash<quint64, Active> active;
+    QSet<QByteArray> dirty;
+    QSet<QByteArray> removed;
+    QElapsedTimer lastFlush;
+    int appended = 0;
+};
+
+}
+
+#endif // _QT_TOX_TRANSFER_JOURNAL_H_
@@ -0,0 +1,23 @@
+#ifndef _QT_TOX_TRANSFER_KEY_H_
+#define _QT_TOX_TRANSFER_KEY_H_
+
+#include <QtGlobal>
+
+#include <cstdint>
+
+inline quint64 transferKey(uint32_t friendNum, uint32_t fileNum)
+{
+    return (static_cast<quint64>(friendNum) << 32) | fileNum;
+}
+
+inline uint32_t transferFriend(quint64 key)
+{
+    return static_cast<uint32_t>(key >> 32);
+}
+
+inline uint32_t transferFile(quint64 key)
+{
+    return static_cast<uint32_t>(key);
+}
+
+#endif // _QT_TOX_TRANSFER_KEY_H_
@@ -0,0 +1,155 @@
+#include "transfermonitor.h"
+
+#include "transferkey.h"
+
+#include <algorithm>
+
+namespace
+{
+
+// a gap between chunks longer than this counts as stall
+const qint64 StallThresholdNs = 500 * 1000 * 1000;
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class TransferMonitor
+ * @brief Collects throughput, latency and stall counters of transfers.
+ *
+ * Every event updates the counters of the transfer and of its friend, so
+ * both views can be queried at any time without aggregating. The friend
+ * view keeps the totals of finished transfers.
+ *
+ * toxcore requests the chunks of a transfer in order and they are sent in
+ * the same order, so pending requests are kept in a fixed ring per transfer.
+ * When the ring is full the oldest request is dropped, it only loses a
+ * latency sample.
+ */
+
+TransferMonitor::TransferMonitor()
+{
+    timer.start();
+}
+
+/**
+ * @brief Records the time toxcore requested a chunk.
+ */
+void TransferMonitor::requested(quint64 key, uint64_t position)
+{
+    auto& entry = transfer(key);
+    if (entry.pending == MaxPendingRequests) {
+        entry.head = (entry.head + 1) % MaxPendingRequests;
+        --entry.pending;
+    }
+
+    const int tail = (entry.head + entry.pending) % MaxPendingRequests;
+    entry.requests[tail] = Request{position, timer.nsecsElapsed()};
+    ++entry.pending;
+}
+
+/**
+ * @brief Records a chunk toxcore accepted for sending.
+ */
+void TransferMonitor::sent(quint64 key, uint64_t position, size_t length)
+{
+    const auto now = timer.nsecsElapsed();
+    auto& entry = transfer(key);
+    auto& total = friends[transferFriend(key)];
+    for (auto stats : {&entry.stats, &total}) {
+        stats->sentBytes += length;
+        ++stats->sentChunks;
+    }
+
+    // the match is almost always at head, requests before it were never
+    // answered, e.g. after a seek, and are dropped with it
+    int skipped = 0;
+    while (skipped < entry.pending
+           && entry.requests[(entry.head + skipped) % MaxPendingRequests].position != position) {
+        ++skipped;
+    }
+
+    if (skipped < entry.pending) {
+        const auto& request = entry.requests[(entry.head + skipped) % MaxPendingRequests];
+        const auto latency = static_cast<uint64_t>(now - request.time);
+        entry.head = (entry.head + skipped + 1) % MaxPendingRequests;
+        entry.pending -= skipped + 1;
+        for (auto stats : {&entry.stats, &total}) {
+            stats->requestLatencyTotalNs += latency;
+            stats->requestLatencyMaxNs = std::max(stats->requestLatencyMaxNs, latency);
+            ++stats->latencySamples;
+        }
+    }
+
+    activity(key, entry, now);
+}
+
+/**
+ * @brief Records a chunk toxcore rejected because its send queue was full.
+ */
+void TransferMonitor::rejected(quint64 key)
+{
+    ++transfer(key).stats.sendqRejects;
+    ++friends[transferFriend(key)].sendqRejects;
+}
+
+/**
+ * @brief Records a received chunk.
+ */
+void TransferMonitor::received(quint64 key, size_t length)
+{
+    auto& entry = transfer(key);
+    auto& total = friends[transferFriend(key)];
+    for (auto stats : {&entry.stats, &total}) {
+        stats->receivedBytes += length;
+        ++stats->receivedChunks;
+    }
+
+    activity(key, entry, timer.nsecsElapsed());
+}
+
+/**
+ * @brief Drops the counters of a finished transfer, its friend keeps them.
+ */
+void TransferMonitor::finish(quint64 key)
+{
+    transfers.remove(key);
+}
+
+Files::TransferStats TransferMonitor::getTransferStats(quint64 key) const
+{
+    return transfers.value(key).stats;
+}
+
+Files::TransferStats TransferMonitor::getFriendStats(uint32_t friendNum) const
+{
+    return friends.value(friendNum);
+}
+
+TransferMonitor::Transfer& TransferMonitor::transfer(quint64 key)
+{
+    auto it = transfers.find(key);
+    if (it == transfers.end()) {
+        it = transfers.insert(key, Transfer{Files::TransferStats{}, {}, 0, 0, 0});
+    }
+
+    return *it;
+}
+
+void TransferMonitor::activity(quint64 key, Transfer& entry, qint64 now)
+{
+    if (entry.lastActivity != 0 && now - entry.lastActivity > StallThresholdNs) {
+        const auto gap = static_cast<uint64_t>(now - entry.lastActivity);
+        auto& total = friends[transferFriend(key)];
+        for (auto stats : {&entry.stats, &total}) {
+            ++stats->stalls;
+            stats->stallTotalNs += gap;
+        }
+    }
+
+    entry.lastActivity = now;
+}
+
+}
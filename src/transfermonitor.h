@@ -0,0 +1,60 @@
+#ifndef _QT_TOX_TRANSFER_MONITOR_H_
+#define _QT_TOX_TRANSFER_MONITOR_H_
+
+#include "files.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace QtTox
+{
+
+class TransferMonitor
+{
+public:
+    TransferMonitor();
+
+    void requested(quint64 key, uint64_t position);
+    void sent(quint64 key, uint64_t position, size_t length);
+    void rejected(quint64 key);
+    void received(quint64 key, size_t length);
+    void finish(quint64 key);
+
+    Files::TransferStats getTransferStats(quint64 key) const;
+    Files::TransferStats getFriendStats(uint32_t friendNum) const;
+
+private:
+    struct Request
+    {
+        uint64_t position;
+        qint64 time;
+    };
+
+    static const int MaxPendingRequests = 128;
+
+    struct Transfer
+    {
+        Files::TransferStats stats;
+        // requests in the order toxcore made them, oldest at head
+        std::array<Request, MaxPendingRequests> requests;
+        int head;
+        int pending;
+        qint64 lastActivity;
+    };
+
+    Transfer& transfer(quint64 key);
+    void activity(quint64 key, Transfer& entry, qint64 now);
+
+private:
+    QElapsedTimer timer;
+    QHash<quint64, Transfer> transfers;
+    QHash<uint32_t, Files::TransferStats> friends;
+};
+
+}
+
+#endif // _QT_TOX_TRANSFER_MONITOR_H_
@@ -0,0 +1,266 @@
+#include "transferscheduler.h"
+
+#include "transferkey.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+
+// largest chunk toxcore requests
+const uint64_t MaxChunkSize = 1371;
+// bytes a friend of weight 1 may send per round, a few file chunks
+const uint64_t Quantum = 4 * MaxChunkSize;
+// queued requests at which toxcore is asked to stop requesting chunks
+const int PauseThreshold = 64;
+const int ResumeThreshold = 16;
+
+}
+
+namespace QtTox
+{
+
+/**
+ * @class TransferScheduler
+ * @brief Orders the chunk requests of outgoing transfers.
+ *
+ * Requests are queued per priority class and friend. Avatars are always
+ * served before data. Within a class friends are served by deficit round
+ * robin, so the bytes each friend gets are proportional to its weight. A
+ * token bucket caps the total rate when a bandwidth limit is set.
+ * Transfers that pile up requests faster than they are served are paused
+ * and resumed once their backlog drained.
+ */
+
+TransferScheduler::TransferScheduler()
+{
+    refillTimer.start();
+    rateTimer.start();
+}
+
+void TransferScheduler::setKind(quint64 key, Files::FileKind kind)
+{
+    kinds.insert(key, kind);
+}
+
+/**
+ * @brief Sets the share of a friend relative to others, the default is 1.
+ */
+void TransferScheduler::setFriendWeight(uint32_t friendNum, uint32_t weight)
+{
+    if (weight <= 1) {
+        weights.remove(friendNum);
+        return;
+    }
+
+    weights.insert(friendNum, weight);
+}
+
+/**
+ * @brief Caps the bytes served per second over all transfers, 0 is no cap.
+ */
+void TransferScheduler::setBandwidthLimit(uint64_t bytesPerSecond)
+{
+    limit = bytesPerSecond;
+    tokens = std::min(tokens, bucketSize());
+}
+
+/**
+ * @brief Marks a transfer paused by the user, pressure() never resumes those.
+ */
+void TransferScheduler::setUserPaused(quint64 key, bool userPaused)
+{
+    if (userPaused) {
+        this->userPaused.insert(key);
+        paused.remove(key);
+    } else {
+        this->userPaused.remove(key);
+    }
+}
+
+void TransferScheduler::enqueue(quint64 key, uint64_t position, size_t length)
+{
+    auto& cls = classOf(key);
+    const auto friendNum = transferFriend(key);
+    auto& queue = cls.friends[friendNum];
+    if (queue.requests.isEmpty()) {
+        cls.active.append(friendNum);
+    }
+
+    queue.requests.enqueue(Request{key, position, length});
+    ++queued[key];
+}
+
+/**
+ * @brief Drops all state of a finished or canceled transfer.
+ */
+void TransferScheduler::forget(quint64 key)
+{
+    auto& cls = classOf(key);
+    const auto friendNum = transferFriend(key);
+    auto it = cls.friends.find(friendNum);
+    if (it != cls.friends.end()) {
+        auto& requests = it->requests;
+        requests.erase(std::remove_if(requests.begin(), requests.end(),
+                                      [key](const Request& request) {
+                                          return request.key == key;
+                                      }),
+                       requests.end());
+        if (requests.isEmpty()) {
+            cls.friends.erase(it);
+            cls.active.removeOne(friendNum);
+        }
+    }
+
+    kinds.remove(key);
+    queued.remove(key);
+    paused.remove(key);
+    userPaused.remove(key);
+}
+
+/**
+ * @brief Takes the requests to serve now, in the order they should be served.
+ */
+QVector<TransferScheduler::Request> TransferScheduler::schedule()
+{
+    refill();
+    auto out = QVector<Request>{};
+    drain(avatars, out);
+    drain(data, out);
+
+    const auto elapsed = rateTimer.elapsed();
+    if (elapsed >= 1000) {
+        for (auto cls : {&avatars, &data}) {
+            cls->bytesPerSecond = cls->windowBytes * 1000 / static_cast<uint64_t>(elapsed);
+            cls->windowBytes = 0;
+        }
+
+        rateTimer.restart();
+    }
+
+    return out;
+}
+
+/**
+ * @brief Takes all queued requests regardless of the bandwidth limit.
+ */
+QVector<TransferScheduler::Request> TransferScheduler::takeAll()
+{
+    const auto savedLimit = limit;
+    limit = 0;
+    const auto out = schedule();
+    limit = savedLimit;
+    tokens = 0;
+    return out;
+}
+
+/**
+ * @brief Gets the transfers whose backlog crossed the pause or resume mark.
+ */
+void TransferScheduler::pressure(QVector<quint64>* toPause, QVector<quint64>* toResume)
+{
+    for (auto it = queued.cbegin(); it != queued.cend(); ++it) {
+        if (it.value() >= PauseThreshold && !paused.contains(it.key())
+                && !userPaused.contains(it.key())) {
+            paused.insert(it.key());
+            toPause->append(it.key());
+        }
+    }
+
+    for (auto it = paused.begin(); it != paused.end();) {
+        if (queued.value(*it) <= ResumeThreshold) {
+            toResume->append(*it);
+            it = paused.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+Files::TransferThroughput TransferScheduler::getThroughput(Files::FileKind kind) const
+{
+    const auto& cls = kind == Files::FileKind::Avatar ? avatars : data;
+    return Files::TransferThroughput{cls.totalBytes, cls.bytesPerSecond};
+}
+
+TransferScheduler::Class& TransferScheduler::classOf(quint64 key)
+{
+    return kinds.value(key, Files::FileKind::Data) == Files::FileKind::Avatar ? avatars : data;
+}
+
+void TransferScheduler::refill()
+{
+    const auto elapsed = static_cast<uint64_t>(refillTimer.restart());
+    if (limit == 0) {
+        tokens = std::numeric_limits<uint64_t>::max();
+        return;
+    }
+
+    // allow at most one second worth of burst, keep the fraction of a byte
+    // so low limits refill even when called every few milliseconds
+    const auto credit = limit * elapsed + refillCarry;
+    refillCarry = credit % 1000;
+    tokens = std::min(bucketSize(), tokens + credit / 1000);
+}
+
+/**
+ * @brief One second worth of tokens, but at least one chunk, so that limits
+ * below the chunk size slow transfers down instead of stalling them.
+ */
+uint64_t TransferScheduler::bucketSize() const
+{
+    return std::max(limit, MaxChunkSize);
+}
+
+void TransferScheduler::account(Class& cls, size_t length)
+{
+    cls.totalBytes += length;
+    cls.windowBytes += length;
+    if (limit != 0) {
+        tokens -= length;
+    }
+}
+
+void TransferScheduler::drain(Class& cls, QVector<Request>& out)
+{
+    auto progress = true;
+    while (progress && !cls.active.isEmpty()) {
+        progress = false;
+        auto it = cls.active.begin();
+        while (it != cls.active.end()) {
+            auto& queue = cls.friends[*it];
+            // bound the credit friends build up while the token bucket is empty
+            const auto quantum = Quantum * weights.value(*it, 1);
+            queue.deficit = std::min(queue.deficit + quantum, 8 * quantum);
+            while (!queue.requests.isEmpty()) {
+                const auto& head = queue.requests.head();
+                if (head.length > queue.deficit || head.length > tokens) {
+                    break;
+                }
+
+                queue.deficit -= head.length;
+                account(cls, head.length);
+                if (--queued[head.key] <= 0) {
+                    queued.remove(head.key);
+                }
+
+                out.append(queue.requests.dequeue());
+                progress = true;
+            }
+
+            if (queue.requests.isEmpty()) {
+                cls.friends.remove(*it);
+                it = cls.active.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        if (tokens == 0) {
+            break;
+        }
+    }
+}
+
+}
@@ -0,0 +1,83 @@
+#ifndef _QT_TOX_TRANSFER_SCHEDULER_H_
+#define _QT_TOX_TRANSFER_SCHEDULER_H_
+
+#include "files.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+#include <QSet>
+#include <QVector>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace QtTox
+{
+
+class TransferScheduler
+{
+public:
+    struct Request
+    {
+        quint64 key;
+        uint64_t position;
+        size_t length;
+    };
+
+    TransferScheduler();
+
+    void setKind(quint64 key, Files::FileKind kind);
+    void setFriendWeight(uint32_t friendNum, uint32_t weight);
+    void setBandwidthLimit(uint64_t bytesPerSecond);
+    void setUserPaused(quint64 key, bool userPaused);
+
+    void enqueue(quint64 key, uint64_t position, size_t length);
+    void forget(quint64 key);
+    QVector<Request> schedule();
+    QVector<Request> takeAll();
+    void pressure(QVector<quint64>* toPause, QVector<quint64>* toResume);
+
+    Files::TransferThroughput getThroughput(Files::FileKind kind) const;
+
+private:
+    struct FriendQueue
+    {
+        QQueue<Request> requests;
+        uint64_t deficit = 0;
+    };
+
+    struct Class
+    {
+        QHash<uint32_t, FriendQueue> friends;
+        QList<uint32_t> active;
+        uint64_t totalBytes = 0;
+        uint64_t windowBytes = 0;
+        uint64_t bytesPerSecond = 0;
+    };
+
+    Class& classOf(quint64 key);
+    uint64_t bucketSize() const;
+    void refill();
+    void account(Class& cls, size_t length);
+    void drain(Class& cls, QVector<Request>& out);
+
+private:
+    Class avatars;
+    Class data;
+    QHash<quint64, Files::FileKind> kinds;
+    QHash<uint32_t, uint32_t> weights;
+    QHash<quint64, int> queued;
+    QSet<quint64> paused;
+    QSet<quint64> userPaused;
+    uint64_t limit = 0;
+    uint64_t tokens = 0;
+    uint64_t refillCarry = 0;
+    QElapsedTimer refillTimer;
+    QElapsedTimer rateTimer;
+};
+
+}
+
+#endif // _QT_TOX_TRANSFER_SCHEDULER_H_